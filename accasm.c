@@ -0,0 +1,554 @@
+/*
+ * accasm.c - AccCom assembler and program image files
+ *
+ * Usage: accasm source [-o image [-strip]]
+ * (built with -DACCASM_MAIN; the simulator links the same code for
+ * -load and -asm)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "accasm.h"
+
+//========================================
+// Program image
+// - assembled program or image file mapped into memory
+// - image file: header, DATA bytes, CODE bytes, symbol table
+//   sections hold big-endian words as in memory, the header and the
+//   symbol addresses are in host byte order
+//========================================
+#define PROGRAM_MAGIC	0x4D494341	// "ACIM"
+#define PROGRAM_VERSION	2		// 2: stack region
+
+typedef struct {
+	UINT magic;				// PROGRAM_MAGIC
+	UINT version;			// PROGRAM_VERSION
+	UINT header_size;		// sizeof(ProgramHeader)
+	UINT data_bgn, data_end;
+	UINT code_bgn, code_end;
+	UINT entry;
+	UINT data_off;			// file offset of DATA bytes
+	UINT code_off;			// file offset of CODE bytes
+	UINT sym_off;			// file offset of Symbol[nsym], 4-byte aligned
+	UINT nsym;				// 0: no symbols
+	UINT stack_bgn;			// version 2: stack region, 0 ~ 0: default
+	UINT stack_end;
+} ProgramHeader;
+
+#define PROGRAM_HEADER_V1	offsetof(ProgramHeader, stack_bgn)
+
+// Name of the symbol at addr, NULL if none
+const char *symName(const Symbol *sym, int nsym, UINT addr) {
+	int i;
+
+	for (i = 0; i < nsym; i++)
+		if (sym[i].addr == addr) return sym[i].name;
+	return NULL;
+}
+
+// Address of a symbol, -1 if not defined
+int symAddr(const Symbol *sym, int nsym, const char *name) {
+	int i;
+
+	for (i = 0; i < nsym; i++)
+		if (strcmp(sym[i].name, name) == 0) return (int)sym[i].addr;
+	return -1;
+}
+
+// Write an image file
+// - with_sym: include the symbol table
+int programWrite(const Program *prog, const char *path, int with_sym) {
+	static const UCHAR pad[4];
+	ProgramHeader h;
+	UINT data_len = prog->data_end - prog->data_bgn;
+	UINT code_len = prog->code_end - prog->code_bgn;
+	FILE *fp = fopen(path, "wb");
+
+	if (fp == NULL) {
+		fprintf(stderr, "%s: cannot write\n", path);
+		return 1;
+	}
+	memset(&h, 0, sizeof(h));
+	h.magic = PROGRAM_MAGIC;
+	h.version = PROGRAM_VERSION;
+	h.header_size = sizeof(h);
+	h.data_bgn = prog->data_bgn; h.data_end = prog->data_end;
+	h.code_bgn = prog->code_bgn; h.code_end = prog->code_end;
+	h.entry = prog->entry;
+	h.data_off = sizeof(h);
+	h.code_off = h.data_off + data_len;
+	h.sym_off = (h.code_off + code_len + 3) & ~3U;
+	h.nsym = with_sym ? (UINT)prog->nsym : 0;
+	h.stack_bgn = prog->stack_bgn;
+	h.stack_end = prog->stack_end;
+	fwrite(&h, sizeof(h), 1, fp);
+	fwrite(prog->data, 1, data_len, fp);
+	fwrite(prog->code, 1, code_len, fp);
+	fwrite(pad, 1, h.sym_off - (h.code_off + code_len), fp);
+	fwrite(prog->sym, sizeof(Symbol), h.nsym, fp);
+	fclose(fp);
+	return 0;
+}
+
+static int sectionOk(UINT bgn, UINT end, UINT off, size_t size) {
+	return bgn <= end && end <= MEM_SIZE && off <= size && end - bgn <= size - off;
+}
+
+// Map an image file, sections and symbols are used in place
+int programMap(Program *prog, const char *path) {
+	const ProgramHeader *h;
+	struct stat st;
+	void *map;
+	UINT i;
+	int fd = open(path, O_RDONLY);
+
+	memset(prog, 0, sizeof(Program));
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		fprintf(stderr, "%s: cannot open\n", path);
+		if (fd >= 0) close(fd);
+		return 1;
+	}
+	if ((size_t)st.st_size < PROGRAM_HEADER_V1 ||
+		(map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		fprintf(stderr, "%s: bad image\n", path);
+		close(fd);
+		return 1;
+	}
+	close(fd);
+	prog->map = map;
+	prog->map_size = st.st_size;
+
+	h = map;
+	if (h->magic != PROGRAM_MAGIC) {
+		fprintf(stderr, "%s: bad image\n", path);
+		goto fail;
+	}
+	if (h->version < 1 || h->version > PROGRAM_VERSION) {
+		fprintf(stderr, "%s: image version %u, expected 1 ~ %u\n", path, h->version, PROGRAM_VERSION);
+		goto fail;
+	}
+	if (h->header_size < (h->version == 1 ? PROGRAM_HEADER_V1 : sizeof(ProgramHeader)) ||
+		h->header_size > prog->map_size) {
+		fprintf(stderr, "%s: bad image\n", path);
+		goto fail;
+	}
+	if (h->version >= 2 && (h->stack_bgn != 0 || h->stack_end != 0)) {
+		if (!stackOk(h->stack_bgn, h->stack_end)) {
+			fprintf(stderr, "%s: corrupt image\n", path);
+			goto fail;
+		}
+		prog->stack_bgn = h->stack_bgn;
+		prog->stack_end = h->stack_end;
+	}
+	if (!sectionOk(h->data_bgn, h->data_end, h->data_off, prog->map_size) ||
+		!sectionOk(h->code_bgn, h->code_end, h->code_off, prog->map_size) ||
+		h->entry >= MEM_SIZE || h->nsym > SYM_MAX || (h->sym_off & 3) != 0 ||
+		h->sym_off > prog->map_size || h->nsym*sizeof(Symbol) > prog->map_size - h->sym_off) {
+		fprintf(stderr, "%s: corrupt image\n", path);
+		goto fail;
+	}
+	prog->data_bgn = h->data_bgn; prog->data_end = h->data_end;
+	prog->code_bgn = h->code_bgn; prog->code_end = h->code_end;
+	prog->entry = h->entry;
+	prog->data = (const UCHAR *)map + h->data_off;
+	prog->code = (const UCHAR *)map + h->code_off;
+	prog->sym = (const Symbol *)((const UCHAR *)map + h->sym_off);
+	prog->nsym = (int)h->nsym;
+	for (i = 0; i < h->nsym; i++) {
+		if (prog->sym[i].name[SYM_NAME - 1] != '\0') {
+			fprintf(stderr, "%s: corrupt symbol table\n", path);
+			goto fail;
+		}
+	}
+	return 0;
+
+fail:
+	munmap(prog->map, prog->map_size);
+	prog->map = NULL;
+	return 1;
+}
+
+void programClose(Program *prog) {
+	if (prog->map != NULL) munmap(prog->map, prog->map_size);
+	prog->map = NULL;
+}
+
+//========================================
+// Assembler
+// - two passes over the source: pass 1 assigns addresses to labels,
+//   pass 2 emits words
+// - source line: [label:] [mnemonic operand | directive] [; comment]
+// - directives: .data [addr]  .code [addr]  .entry expr
+//               .word expr, ...  .string "text"  .stack bgn, end
+// - expr: number, 'c', label, label+n, label-n
+//   decimal numbers are AccCom numbers (sign-magnitude), 0x... raw words
+//========================================
+#define ASM_LINE	256
+
+typedef struct {
+	Program *prog;
+	const char *path;
+	int  pass;			// 1 or 2
+	int  lineno;
+	int  errors;
+	int  section;		// 0: none, 'D': DATA, 'C': CODE
+	UINT loc;			// location counter
+	int  have_data, have_code, have_entry;
+} Asm;
+
+static const struct {
+	const char *name;
+	UINT word;			// opcode bits, operand or-ed in
+	int  operand;		// takes an operand
+} asm_op[] = {
+	{ "LDA", 0x1000, 1 }, { "STA", 0x2000, 1 }, { "ADD", 0x3000, 1 },
+	{ "SUB", 0x4000, 1 }, { "JMP", 0x5000, 1 }, { "MUL", 0x7000, 1 },
+	{ "JZ",  0x9000, 1 }, { "JN",  0xA000, 1 }, { "PRT", 0xB000, 1 },
+	{ "PRC", 0xC000, 1 }, { "PRS", 0xD000, 1 },
+	{ "CALL", 0x6000, 1 },
+	{ "IAC", 0x8002, 0 }, { "HLT", 0x8000, 0 }, { "RET", 0x8001, 0 },
+	{ "PUSH", 0x8003, 0 }, { "POP", 0x8004, 0 },
+	{ NULL, 0, 0 }
+};
+
+static void asmError(Asm *as, const char *fmt, ...) {
+	va_list ap;
+
+	if (as->pass != 2) return;		// report once
+	fprintf(stderr, "%s:%d: ", as->path, as->lineno);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+	as->errors++;
+}
+
+static char *skipSpace(char *s) {
+	while (*s == ' ' || *s == '\t') s++;
+	return s;
+}
+
+static int isIdent(int c, int first) {
+	return c == '_' || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (!first && c >= '0' && c <= '9');
+}
+
+// Escaped char of 'c' and "text" at *s, advance *s
+static int asmChar(char **s) {
+	int c = (unsigned char)*(*s)++;
+
+	if (c != '\\') return c;
+	c = (unsigned char)*(*s)++;
+	switch (c) {
+	case 'n': return '\n';
+	case 't': return '\t';
+	case '0': return '\0';
+	default:  return c;		// \\ \' \"
+	}
+}
+
+// Evaluate expr at *s, advance *s
+// - *raw: value is a raw word (hex, char, label), not a decimal AccCom number
+static int asmExpr(Asm *as, char **s, int *raw) {
+	char name[SYM_NAME], *p = skipSpace(*s), *end;
+	int value, n, addr;
+
+	*raw = 1;
+	if (*p == '\'') {
+		p++;
+		value = asmChar(&p);
+		if (*p++ != '\'') asmError(as, "bad char constant");
+	}
+	else if (isIdent(*p, 1)) {
+		for (n = 0; isIdent(*p, 0); p++)
+			if (n < SYM_NAME - 1) name[n++] = *p;
+		name[n] = '\0';
+		addr = symAddr(as->prog->symtab, as->prog->nsym, name);
+		if (addr < 0 && as->pass == 2) asmError(as, "undefined label '%s'", name);
+		value = (addr < 0) ? 0 : addr;
+		p = skipSpace(p);
+		if (*p == '+' || *p == '-') {
+			n = (int)strtol(p + 1, &end, 0);
+			if (end == p + 1) asmError(as, "bad offset");
+			value += (*p == '+') ? n : -n;
+			p = end;
+		}
+	}
+	else {
+		value = (int)strtol(p, &end, 0);
+		if (end == p) {
+			asmError(as, "bad operand '%s'", p);
+			end = p + strlen(p);
+		}
+		*raw = (p[0] == '0' && (p[1] == 'x' || p[1] == 'X'));
+		p = end;
+	}
+	*s = skipSpace(p);
+	return value;
+}
+
+static void asmWord(Asm *as, UINT word) {
+	if (as->section == 0) {
+		asmError(as, "no .data or .code section");
+		return;
+	}
+	if (as->loc + 2 > MEM_SIZE) {
+		asmError(as, "address %04X out of memory", as->loc);
+		return;
+	}
+	if (as->pass == 2) {
+		as->prog->mem[as->loc] = (UCHAR)((word >> 8) & 0xFF);
+		as->prog->mem[as->loc + 1] = (UCHAR)(word & 0xFF);
+	}
+	as->loc += 2;
+}
+
+// Close the current section at the location counter
+static void asmEndSection(Asm *as) {
+	if (as->section == 'D') as->prog->data_end = as->loc;
+	if (as->section == 'C') as->prog->code_end = as->loc;
+}
+
+static void asmDirective(Asm *as, char *dir, char *arg) {
+	int value = 0, raw, c, n;
+
+	if (strcmp(dir, ".data") == 0 || strcmp(dir, ".code") == 0) {
+		int *have = (dir[1] == 'd') ? &as->have_data : &as->have_code;
+		if (*have) asmError(as, "%s section already defined", dir);
+		*have = 1;
+		asmEndSection(as);
+		as->section = (dir[1] == 'd') ? 'D' : 'C';
+		as->loc = (*arg != '\0') ? (UINT)asmExpr(as, &arg, &raw) : (dir[1] == 'd') ? 0x0100 : 0x0200;
+		if (as->section == 'D') as->prog->data_bgn = as->loc;
+		else as->prog->code_bgn = as->loc;
+	}
+	else if (strcmp(dir, ".entry") == 0) {
+		as->prog->entry = (UINT)asmExpr(as, &arg, &raw);
+		as->have_entry = 1;
+	}
+	else if (strcmp(dir, ".stack") == 0) {
+		UINT bgn = (UINT)asmExpr(as, &arg, &raw), end;
+		if (*arg != ',') {
+			asmError(as, ".stack needs bgn, end");
+			return;
+		}
+		arg++;
+		end = (UINT)asmExpr(as, &arg, &raw);
+		if (!stackOk(bgn, end)) asmError(as, "bad stack region %04X ~ %04X", bgn, end);
+		as->prog->stack_bgn = bgn;
+		as->prog->stack_end = end;
+	}
+	else if (strcmp(dir, ".word") == 0) {
+		do {
+			if (*arg == ',') arg++;
+			value = asmExpr(as, &arg, &raw);
+			asmWord(as, raw ? (UINT)value & 0xFFFF : cint2accnum(value));
+		} while (*arg == ',');
+	}
+	else if (strcmp(dir, ".string") == 0) {
+		if (*arg++ != '"') {
+			asmError(as, ".string needs \"text\"");
+			return;
+		}
+		for (n = 0; ; n++) {		// two chars per word, '\0' terminated
+			c = (*arg == '"' || *arg == '\0') ? 0 : asmChar(&arg);
+			if (n%2 == 0) value = c << 8;
+			else asmWord(as, value | c);
+			if (c == 0) break;
+		}
+		if (n%2 == 0) asmWord(as, value);
+		if (*arg != '"') asmError(as, "unterminated string");
+		else arg++;
+	}
+	else {
+		asmError(as, "unknown directive %s", dir);
+		return;
+	}
+	if (*skipSpace(arg) != '\0' && strcmp(dir, ".string") != 0) asmError(as, "junk after %s", dir);
+}
+
+static void asmLine(Asm *as, char *line) {
+	char word[ASM_LINE], *p, *q, *mark;
+	int i, n, raw, addr, quote = 0;
+	UINT operand;
+
+	// strip comment outside quotes
+	for (p = line; *p != '\0'; p++) {
+		if (*p == '"' || *p == '\'') quote = (quote == *p) ? 0 : (quote ? quote : *p);
+		if (quote == 0 && (*p == ';' || (p[0] == '/' && p[1] == '/'))) break;
+		if (quote != 0 && *p == '\\' && p[1] != '\0') p++;
+	}
+	*p = '\0';
+	for (q = p; q > line && (q[-1] == ' ' || q[-1] == '\t' || q[-1] == '\r' || q[-1] == '\n'); ) *--q = '\0';
+
+	p = skipSpace(line);
+	mark = p;
+	for (n = 0; isIdent(*p, n == 0) || (n == 0 && *p == '.'); p++, n++) word[n] = *p;
+	word[n] = '\0';
+
+	if (n > 0 && *p == ':') {		// label
+		addr = symAddr(as->prog->symtab, as->prog->nsym, word);
+		if (n >= SYM_NAME) asmError(as, "label '%s' too long", word);
+		else if (as->pass == 1 && addr < 0 && as->prog->nsym < SYM_MAX) {
+			strcpy(as->prog->symtab[as->prog->nsym].name, word);
+			as->prog->symtab[as->prog->nsym++].addr = as->loc;
+		}
+		else if (as->pass == 2 && addr < 0) asmError(as, "too many labels");
+		else if (as->pass == 2 && (UINT)addr != as->loc) asmError(as, "label '%s' redefined", word);
+		asmLine(as, p + 1);
+		return;
+	}
+	if (n == 0) {
+		if (*mark != '\0') asmError(as, "syntax error");
+		return;
+	}
+	p = skipSpace(p);
+	if (word[0] == '.') {
+		asmDirective(as, word, p);
+		return;
+	}
+
+	for (q = word; *q != '\0'; q++)
+		if (*q >= 'a' && *q <= 'z') *q -= 'a' - 'A';
+	for (i = 0; asm_op[i].name != NULL; i++)
+		if (strcmp(asm_op[i].name, word) == 0) break;
+	if (asm_op[i].name == NULL) {
+		asmError(as, "unknown mnemonic %s", word);
+		return;
+	}
+	operand = 0;
+	if (asm_op[i].operand) {
+		if (*p == '\0') asmError(as, "%s needs an operand", word);
+		else {
+			operand = (UINT)asmExpr(as, &p, &raw);
+			if (operand > 0x0FFF) asmError(as, "operand %X out of range", operand);
+		}
+	}
+	if (*p != '\0') asmError(as, "junk after %s", word);
+	asmWord(as, asm_op[i].word | (operand & 0x0FFF));
+}
+
+// Assemble source text, return # of errors
+int asmSource(Program *prog, const char *path, char *src) {
+	Asm as;
+	char line[ASM_LINE], *p, *nl;
+	size_t len;
+
+	memset(prog, 0, sizeof(Program));
+	memset(&as, 0, sizeof(as));
+	as.prog = prog;
+	as.path = path;
+	for (as.pass = 1; as.pass <= 2; as.pass++) {
+		as.lineno = 0;
+		as.section = 0;
+		as.loc = 0;
+		as.have_data = as.have_code = as.have_entry = 0;
+		for (p = src; *p != '\0'; p = (nl != NULL) ? nl + 1 : p + len) {
+			nl = strchr(p, '\n');
+			len = (nl != NULL) ? (size_t)(nl - p) : strlen(p);
+			as.lineno++;
+			if (len >= ASM_LINE) {
+				asmError(&as, "line too long");
+				continue;
+			}
+			memcpy(line, p, len);
+			line[len] = '\0';
+			asmLine(&as, line);
+		}
+		asmEndSection(&as);
+	}
+	if (!as.have_code) {
+		as.pass = 2;
+		asmError(&as, "no .code section");
+	}
+	if (!as.have_entry) prog->entry = prog->code_bgn;
+	prog->data = prog->mem + prog->data_bgn;
+	prog->code = prog->mem + prog->code_bgn;
+	prog->sym = prog->symtab;
+	return as.errors;
+}
+
+// Read source or image file into prog, return 0 on success
+int programOpen(Program *prog, const char *path) {
+	FILE *fp = fopen(path, "rb");
+	char *src;
+	long size;
+	UINT magic = 0;
+	int errors;
+
+	if (fp == NULL) {
+		fprintf(stderr, "%s: cannot open\n", path);
+		return 1;
+	}
+	if (fread(&magic, sizeof(magic), 1, fp) == 1 && magic == PROGRAM_MAGIC) {
+		fclose(fp);
+		return programMap(prog, path);
+	}
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	rewind(fp);
+	src = malloc(size + 1);
+	if (src == NULL || fread(src, 1, size, fp) != (size_t)size) {
+		fprintf(stderr, "%s: cannot read\n", path);
+		free(src);
+		fclose(fp);
+		return 1;
+	}
+	src[size] = '\0';
+	fclose(fp);
+	errors = asmSource(prog, path, src);
+	free(src);
+	if (errors) fprintf(stderr, "%s: %d error(s)\n", path, errors);
+	return errors != 0;
+}
+
+// Compare symbols by address, then name
+static int symCompare(const void *p, const void *q) {
+	const Symbol *a = p, *b = q;
+	if (a->addr != b->addr) return (a->addr > b->addr) - (a->addr < b->addr);
+	return strcmp(a->name, b->name);
+}
+
+// -asm: assemble a source file, print symbol table, write image
+// - with_sym: keep the symbol table in the image
+int assemble(const char *src_path, const char *out_path, int with_sym) {
+	static Program prog;
+	Symbol sym[SYM_MAX];
+	int i;
+
+	if (programOpen(&prog, src_path)) return 1;
+	printf("DATA %04X-%04X CODE %04X-%04X ENTRY %04X\n",
+		prog.data_bgn, prog.data_end, prog.code_bgn, prog.code_end, prog.entry);
+	memcpy(sym, prog.sym, prog.nsym*sizeof(Symbol));
+	qsort(sym, prog.nsym, sizeof(Symbol), symCompare);
+	for (i = 0; i < prog.nsym; i++)
+		printf("%04X %s\n", sym[i].addr, sym[i].name);
+	return (out_path != NULL) ? programWrite(&prog, out_path, with_sym) : 0;
+}
+
+
+#ifdef ACCASM_MAIN
+int main(int argc, char *argv[]) {
+	char *src_file = NULL;		// source to assemble
+	char *out_file = NULL;		// image to write
+	int strip = 0;				// leave symbols out of the image
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) out_file = argv[++i];
+		else if (strcmp(argv[i], "-strip") == 0) strip = 1;
+		else if (argv[i][0] != '-' && src_file == NULL) src_file = argv[i];
+		else break;
+	}
+	if (i < argc || src_file == NULL) {
+		fprintf(stderr, "usage: %s source [-o image [-strip]]\n", argv[0]);
+		return 1;
+	}
+	return assemble(src_file, out_file, !strip);
+}
+#endif
@@ -0,0 +1,59 @@
+/*
+ * accasm.h - AccCom assembler and program image files
+ *
+ * Used by the simulator (-load, -asm, -opt) and by the accasm tool
+ */
+
+#ifndef ACCASM_H
+#define ACCASM_H
+
+#include <stddef.h>
+#include "accom.h"
+
+//========================================
+// Program image
+// - assembled program or image file mapped into memory
+// - image file: header, DATA bytes, CODE bytes, symbol table
+//   sections hold big-endian words as in memory, the header and the
+//   symbol addresses are in host byte order
+//========================================
+typedef struct {
+	UINT data_bgn, data_end;
+	UINT code_bgn, code_end;
+	UINT entry;				// start address
+	UINT stack_bgn, stack_end;	// .stack region, 0 ~ 0: default
+	const UCHAR  *data;		// DATA section bytes
+	const UCHAR  *code;		// CODE section bytes
+	const Symbol *sym;		// labels
+	int  nsym;
+
+	void  *map;				// mapped image file, NULL: assembled
+	size_t map_size;
+	UCHAR  mem[MEM_SIZE];	// assembler output
+	Symbol symtab[SYM_MAX];
+} Program;
+
+// Symbol table lookups
+const char *symName(const Symbol *sym, int nsym, UINT addr);
+int symAddr(const Symbol *sym, int nsym, const char *name);
+
+// Image files
+int programWrite(const Program *prog, const char *path, int with_sym);
+int programMap(Program *prog, const char *path);
+void programClose(Program *prog);
+
+//========================================
+// Assembler
+// - two passes over the source: pass 1 assigns addresses to labels,
+//   pass 2 emits words
+// - source line: [label:] [mnemonic operand | directive] [; comment]
+// - directives: .data [addr]  .code [addr]  .entry expr
+//               .word expr, ...  .string "text"  .stack bgn, end
+// - expr: number, 'c', label, label+n, label-n
+//   decimal numbers are AccCom numbers (sign-magnitude), 0x... raw words
+//========================================
+int asmSource(Program *prog, const char *path, char *src);
+int programOpen(Program *prog, const char *path);
+int assemble(const char *src_path, const char *out_path, int with_sym);
+
+#endif
@@ -0,0 +1,69 @@
+/*
+ * accom.h - AccCom machine definitions shared by the simulator and the assembler
+ */
+
+#ifndef ACCOM_H
+#define ACCOM_H
+
+#include <stdlib.h>
+
+typedef unsigned char UCHAR;
+typedef unsigned int  UINT;
+
+// Address space, chosen at build time
+// - MEM_SIZE: 0x1000 (default) ~ 0x10000 bytes, cc -DMEM_SIZE=0x10000;
+//   operands stay 12-bit, memory above 4 KiB is reached by pc,
+//   PRS strings and loaded images
+// - MEM_PAD zero bytes follow the memory, so that a word at the last
+//   address, a PRS string or a pc running off the end stay in the array
+// - MEM_CHECK (cc -DMEM_CHECK): out-of-range accesses trap with PC
+//   context; without it the checks compile away
+#ifndef MEM_SIZE
+#define MEM_SIZE	0x1000
+#endif
+#if MEM_SIZE < 0x1000 || MEM_SIZE > 0x10000
+#error "MEM_SIZE must be 0x1000 ~ 0x10000"
+#endif
+#define MEM_PAD		4
+#define MEM_ALLOC	(MEM_SIZE + MEM_PAD)
+
+// Default stack region mem[STACK_BGN] ~ mem[STACK_END - 1] of CALL/PUSH
+// - a program may move it with .stack, the build with -DSTACK_END=...
+#ifndef STACK_BGN
+#define STACK_BGN	0x0000
+#endif
+#ifndef STACK_END
+#define STACK_END	0x0100
+#endif
+
+// Label of an assembled program
+#define SYM_NAME	32		// max label length + 1
+#define SYM_MAX		256		// max # of labels
+
+typedef struct {
+	char name[SYM_NAME];
+	UINT addr;
+} Symbol;
+
+// Convert AccCom number to C int type
+static inline int accnum2cint(UINT n) {
+	UINT sign_n = n & 0x8000;	// sign of n
+	UINT data_n = n & 0x7FFF;	// absolute value of n
+	int i = (sign_n ? -1 : 1)*data_n;
+	return i;
+}
+
+// Convert C int to AccCom number type
+static inline UINT cint2accnum(int i) {
+	UINT sign_n = (UINT)((i < 0) ? 0x8000 : 0);
+	UINT data_n = (UINT)abs(i) & 0x7FFF;
+	UINT n = sign_n | data_n;
+	return n;
+}
+
+// Stack region bgn ~ end - 1 holds at least one word inside memory
+static inline int stackOk(UINT bgn, UINT end) {
+	return bgn < end && end <= MEM_SIZE && (end - bgn)%2 == 0;
+}
+
+#endif
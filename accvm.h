@@ -0,0 +1,330 @@
+/*
+ * accvm.h - AccCom machine state and the simulator functions shared by
+ * pyramid.c and its modules (aot.c, peephole.c, simt.c)
+ */
+
+#ifndef ACCVM_H
+#define ACCVM_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include "accom.h"
+#include "accasm.h"
+
+//========================================
+// Machine types
+//========================================
+
+// Decoded instruction: IR split into opcode and operand address
+typedef struct {
+	UCHAR op;			// IR[15:12]
+	UINT  operand;		// IR[11:0]
+} DecodedInst;
+
+// Execution engines for runProgram()
+enum {
+	ENGINE_SWITCH,		// if/else chain on opcode
+	ENGINE_TABLE,		// handler table indexed by opcode
+	ENGINE_THREADED,	// computed goto (GCC), falls back to ENGINE_TABLE
+	ENGINE_BLOCK,		// basic blocks with fused superinstructions
+	ENGINE_JIT,			// x86-64 native code, falls back to ENGINE_BLOCK
+	ENGINE_COUNT
+};
+
+// Basic block of micro-ops for ENGINE_BLOCK
+#define BLOCK_MAX	32		// max micro-ops per block
+#define BLOCK_POOL	512		// max cached blocks before flush
+
+typedef struct {
+	UCHAR uop;			// micro-op (U_xxx)
+	UCHAR n;			// # of AccCom instructions covered
+	UINT  a, b, c;		// operands (U_CALL: a operand, b opcode, c pc)
+} MicroOp;
+
+typedef struct {
+	UINT    entry;		// entry pc
+	int     len;		// # of micro-ops
+	UINT    next;		// pc after the last instruction
+	MicroOp op[BLOCK_MAX];
+} Block;
+
+// Counted loop for runAccel()
+// - the instructions of one iteration in execution order, starting at
+//   the loop header
+#define LOOP_LEN	32		// max instructions per iteration
+
+typedef struct {
+	UINT head;				// header pc
+	UINT exit_pc;			// pc after the loop
+	int  len;				// # of instructions per iteration
+	int  branch;			// index of the exit JZ/JN in inst[]
+	int  latch;				// the branch is the back edge: taken stays in the loop
+	int  store;				// index of the STA of the induction variable
+	UINT iv;				// induction variable address
+	int  nout;				// # of PRC chars per iteration
+	int  nout_pre;			// # of PRC chars before the branch
+	DecodedInst inst[LOOP_LEN];
+	char out[LOOP_LEN];		// PRC chars of one iteration
+} Loop;
+
+typedef struct AccComVM AccComVM;
+typedef void (*JitFn)(AccComVM *vm);
+
+// Execution profile, collected by runProfile()
+// - one AccCom instruction counts as one cycle
+#define PROF_OPS	21		// opcodes 0..F, IAC, HLT, RET, PUSH, POP
+#define PROF_IAC	16
+#define PROF_HLT	17
+#define PROF_RET	18
+#define PROF_PUSH	19
+#define PROF_POP	20
+#define PROF_DEPTH	1024	// max tracked call depth
+
+typedef unsigned long long Count;
+
+typedef struct {
+	Count op[PROF_OPS];			// executions per opcode
+	Count at_pc[MEM_ALLOC];		// executions per pc
+	UCHAR leader_at[MEM_ALLOC];	// pc starts a basic block
+	Count taken[MEM_ALLOC];		// JZ/JN taken per pc
+	Count not_taken[MEM_ALLOC];	// JZ/JN not taken per pc
+	Count reads[MEM_SIZE];		// operand reads per address
+	Count writes[MEM_SIZE];		// operand writes per address
+	Count calls[MEM_SIZE];		// CALLs per subroutine entry
+	Count incl[MEM_SIZE];		// instructions in subroutine and its callees
+	Count excl[MEM_SIZE];		// instructions in subroutine itself
+	struct {
+		UINT  entry;			// subroutine entry
+		Count start;			// inst_count at CALL
+		Count child;			// instructions spent in callees
+	} frame[PROF_DEPTH];		// shadow call stack
+	int   depth;				// # of open CALLs, may exceed PROF_DEPTH
+	int   leader;				// next instruction starts a basic block
+} Profile;
+
+// Trace record of one executed instruction
+#define TRACE_NO_WRITE	0xFFFF	// waddr of instructions without memory write
+
+typedef struct {
+	unsigned short pc;		// address of the instruction
+	unsigned short ir;		// instruction word as fetched
+	int   acc;				// ACC after execution
+	unsigned short waddr;	// address written by STA
+	unsigned short wval;	// word written by STA
+	UCHAR psw;				// PSW after execution: bit 0 zero, bit 1 sign
+	UCHAR pad[3];
+} TraceRec;
+
+typedef struct {
+	TraceRec *rec;			// ring of mask + 1 records, NULL: tracing off
+	UINT mask;
+	unsigned long long pos;	// # of records written
+} TraceRing;
+
+// Dirty page tracking for checkpoints
+// - every word write marks its page(s), the last entry catches words
+//   that end in the zero pad
+// - the last page is short when MEM_SIZE is not a multiple of SNAP_PAGE
+#define SNAP_SHIFT	8
+#define SNAP_PAGE	(1 << SNAP_SHIFT)			// bytes per page
+#define SNAP_PAGES	((MEM_SIZE + SNAP_PAGE - 1) >> SNAP_SHIFT)	// # of pages in memory
+
+// Watchdog of runaway runs
+#define WATCH_TAIL	16			// # of block entries kept for the report
+#define WATCH_CLOCK	(1 << 16)	// # of instructions between clock reads
+
+// Output sink of PRT/PRC/PRS
+// - bytes collect in buf and are handed to drain() when buf is full,
+//   at the end of a run (HLT) or on sinkFlush()
+#define SINK_SIZE	0x10000		// sink buffer size
+
+typedef struct OutputSink OutputSink;
+struct OutputSink {
+	void (*drain)(OutputSink *sink, const char *data, size_t len);
+	FILE  *fp;			// sinkFile(): destination stream
+	char  *mem;			// sinkMemory(): collected output
+	size_t mem_len;
+	size_t mem_cap;
+	size_t len;			// # of bytes in buf
+	unsigned long long dropped;	// sinkNull(): # of bytes discarded
+	char   buf[SINK_SIZE];
+};
+
+//========================================
+// AccCom machine
+// - all state of one simulated computer, so that
+//   many machines can run in one process
+//========================================
+struct AccComVM {
+	UCHAR mem[MEM_ALLOC];	// memory image and zero pad
+#ifdef WORD_MEMORY
+	short num[MEM_SIZE];	// AccCom number of the word at each address
+#endif
+
+	UINT data_bgn;			// begin address of DATA section
+	UINT data_end;			// end address of DATA section
+	UINT code_bgn;			// begin address of CODE section
+	UINT code_end;			// end address of CODE section
+
+	int tos;				// top of stack, next free address
+	UINT stack_bgn;			// stack region mem[stack_bgn] ~ mem[stack_end - 1]
+	UINT stack_end;
+	int acc;				// accumulator
+	UINT pc;				// program counter
+	int psw_zerobit;		// PSW zero bit
+	int psw_signbit;		// PSW sign bit
+	int psw_lazy;			// PSW bits are stale, the flags follow ACC
+	OutputSink out;			// output of PRT/PRC/PRS
+
+	int engine;							// ENGINE_xxx
+	unsigned long long inst_count;		// # of executed instructions
+
+	DecodedInst decoded[MEM_SIZE];		// predecoded CODE section, indexed by address
+	int code_dirty;						// CODE written since decodeProgram()
+
+	Block *block_pool;					// ENGINE_BLOCK cache, allocated on first use
+	int    block_used;					// # of blocks in block_pool
+	Block *block_at[MEM_SIZE];			// block cache keyed by entry pc
+
+	UCHAR *jit_buf;						// ENGINE_JIT code buffer, mapped on first use
+	UINT   jit_pos;						// next free byte in jit_buf
+	int    jit_failed;					// mmap failed, use ENGINE_BLOCK
+	JitFn  jit_at[MEM_SIZE];			// translated blocks keyed by entry pc
+
+	int    accel;						// run counted loops in one step
+	Loop  *loop_pool;					// counted loops of CODE section
+	int    loop_count;
+	int    loop_valid;					// loops analyzed since decodeProgram()
+	UINT   loop_root;					// entry the analysis started from
+	unsigned short loop_at[MEM_SIZE];	// loop index + 1 keyed by header pc
+
+	const Symbol *sym;					// labels of the loaded program
+	int nsym;
+
+	Profile *prof;						// profile of runs, NULL: profiling off
+	TraceRing trace;					// last executed instructions
+
+	UCHAR dirty[SNAP_PAGES + 1];		// page written since the last checkpoint
+	FILE *ckpt;							// checkpoint file, NULL: checkpointing off
+	unsigned long long ckpt_every;		// # of instructions between checkpoints
+
+	unsigned long long budget;			// max instructions per run, 0: no limit
+	double timeout;						// max seconds per run, 0: no limit
+	unsigned short tail[WATCH_TAIL];	// last block entries of a guarded run
+	UINT tail_pos;
+};
+
+//========================================
+// Simulator functions (pyramid.c)
+//========================================
+
+// Input variables of the loaded program, by name
+typedef struct {
+	const char *name;
+	UINT addr;
+} InputVar;
+
+extern const InputVar input_var[];	// built-in program: Height at 0x0100
+extern Program *program;			// -load: replaces the built-in program
+
+AccComVM *vmCreate();
+void vmDestroy(AccComVM *vm);
+void vmReset(AccComVM *vm);
+UINT readWord(AccComVM *vm, UINT addr);
+void writeWord(AccComVM *vm, UINT addr, UINT data);
+void sinkMemory(OutputSink *sink);
+UINT programLoad(AccComVM *vm, const Program *prog);
+UINT loadProgram(AccComVM *vm);
+int  inputAddr(AccComVM *vm, const char *name);
+void inputData(AccComVM *vm);
+int  runProgram(AccComVM *vm, UINT addr);
+
+// CFG of the CODE section reachable from an entry, see Counted loops
+typedef struct {
+	UINT bgn, last;		// first and last instruction
+	int  succ[2];		// successor blocks, -1: none
+	int  idom;			// immediate dominator, -1: not reached
+	int  rpo;			// reverse postorder number
+} CfgBlock;
+
+typedef struct {
+	AccComVM *vm;
+	UCHAR    *seen;		// instruction reached from the entry
+	UCHAR    *leader;	// instruction starts a block
+	int      *block_of;	// block of each instruction, -1: none
+	CfgBlock *b;
+	int       nb;
+	int      *pred;		// predecessors of block i: pred[pred_at[i]] ~ pred[pred_at[i+1] - 1]
+	int      *pred_at;
+	UCHAR    *body;		// block in the loop being built
+} Cfg;
+
+void cfgAlloc(Cfg *g, AccComVM *vm);
+void cfgFree(Cfg *g);
+int  cfgBuild(Cfg *g, UINT root);
+
+// Update PSW bits from ACC
+static inline void updatePSW(AccComVM *vm) {
+	vm->psw_zerobit = (vm->acc == 0) ? 1 : 0;
+	vm->psw_signbit = (vm->acc < 0) ? 1 : 0;
+}
+
+// Is a whole instruction at pc inside CODE section
+static inline int codeAt(AccComVM *vm, UINT pc) {
+	return pc >= vm->code_bgn && pc + 2 <= vm->code_end;
+}
+
+// Is [addr, addr+1] inside CODE section
+static inline int inCode(AccComVM *vm, UINT addr) {
+	return addr + 1 >= vm->code_bgn && addr < vm->code_end;
+}
+
+//========================================
+// AOT recompiler (aot.c)
+//========================================
+int recompile(AccComVM *vm, UINT entry, const char *path);
+
+//========================================
+// Peephole optimizer (peephole.c)
+//========================================
+int peephole(const char *path, int verify);
+
+//========================================
+// Parallel sweep (pyramid.c) and SIMT sweep (simt.c)
+//========================================
+typedef struct {
+	int    height;
+	int    exit_code;
+	char  *buf;			// output taken from the machine's memory sink
+	size_t len;
+	size_t cap;			// SIMT: size of buf
+} SweepJob;
+
+typedef struct {
+	SweepJob *job;
+	int       count;
+	int       next;		// next job to take
+	UINT      height;	// address of Height
+	const char *simt;	// SIMT kernel, NULL: one machine per run
+	pthread_mutex_t lock;
+} SweepPool;
+
+// SIMT kernel: one instruction on the masked lanes of a group
+typedef struct {
+	const char *name;
+	int  (*supported)(void);
+	void (*load)(int *acc, const int *mask, const int *w, int n);		// LDA
+	void (*arith)(int op, int *acc, const int *mask, const int *w, int n);	// ADD/SUB/MUL
+	void (*iac)(int *acc, const int *mask, int n);
+	void (*store)(const int *acc, const int *mask, int *w, int n);		// STA
+	int  (*branch)(int op, const int *acc, const int *mask, int *lpc, int target, int next, int n);	// JZ/JN
+	int  (*select)(const int *lpc, int *mask, int n, int *wait);	// lowest pc, mask of its lanes
+} SimtKernel;
+
+extern const char *simt_isa;		// -simt-isa: kernel name, NULL: best the CPU runs
+
+const SimtKernel *simtKernel(const char *name);
+int   simtUsable(void);
+void *simtWorker(void *arg);
+
+#endif
@@ -0,0 +1,225 @@
+/*
+ * aot.c - AOT recompiler of AccCom programs to C (-aot)
+ */
+
+#include <stdio.h>
+#include "accvm.h"
+
+//========================================
+// AOT recompiler
+// - -aot file.c writes the loaded program as a standalone C program:
+//   cc -O2 -o prog file.c; it reads the input variables from stdin
+//   and writes exactly what runProgram() writes to the output sink
+// - blocks of the CFG from the entry become labels, jumps gotos, ACC a
+//   local; mem[] stays the byte image for PRS, stack and stores; RET
+//   and jumps out of the blocks dispatch on pc
+// - STA into CODE section, CALL/PUSH with the stack in CODE section
+//   and pcs outside the blocks continue in an interpreter of the same
+//   machine built into the file
+//========================================
+static const char aot_runtime[] =
+	"static unsigned char out[1 << 16];\n"
+	"static size_t out_len;\n"
+	"static int tos = STACK_BGN;\n"
+	"\n"
+	"static void flush(void) { fwrite(out, 1, out_len, stdout); out_len = 0; }\n"
+	"static inline void put(int ch) { if (out_len == sizeof(out)) flush(); out[out_len++] = (unsigned char)ch; }\n"
+	"static inline void raised(const char *s) { while (*s != '\\0') put(*s++); }\n"
+	"static inline int dec(unsigned n) { return (n & 0x8000) ? -(int)(n & 0x7FFF) : (int)(n & 0x7FFF); }\n"
+	"static inline unsigned enc(int i) { return (i < 0 ? 0x8000u : 0u) | ((i < 0 ? 0u - (unsigned)i : (unsigned)i) & 0x7FFF); }\n"
+	"static inline unsigned word(unsigned a) { return (unsigned)(mem[a] << 8) | mem[a + 1]; }\n"
+	"static inline int num(unsigned a) { return dec(word(a)); }\n"
+	"static inline void store(unsigned a, int i) { unsigned n = enc(i); mem[a] = (unsigned char)(n >> 8); mem[a + 1] = (unsigned char)n; }\n"
+	"static inline void prt(unsigned a) { char s[16]; int i, n = snprintf(s, sizeof(s), \"%d\", num(a)); for (i = 0; i < n; i++) put(s[i]); }\n"
+	"static inline void prs(unsigned a) { while (mem[a] != '\\0') put(mem[a++]); }\n"
+	"static inline int push(unsigned n) {\n"
+	"\tif ((unsigned)tos + 2 > STACK_END) return -1;\n"
+	"\tmem[tos] = (unsigned char)(n >> 8); mem[tos + 1] = (unsigned char)n; tos += 2;\n"
+	"\treturn 0;\n"
+	"}\n"
+	"static inline int pop(unsigned *n) {\n"
+	"\tif ((unsigned)tos < STACK_BGN + 2) return -1;\n"
+	"\ttos -= 2; *n = word(tos);\n"
+	"\treturn 0;\n"
+	"}\n"
+	"\n"
+	"/* the machine for what the compiled blocks do not cover\n"
+	"   lazy = 0: the PSW bits are still the initial 0, 0 */\n"
+	"static void interp(unsigned pc, int acc, int lazy) {\n"
+	"\tunsigned ir, a, n;\n"
+	"\n"
+	"\twhile (pc != CODE_END) {\n"
+	"\t\tir = word(pc); a = ir & 0x0FFF;\n"
+	"\t\tswitch (ir >> 12) {\n"
+	"\t\tcase 0x1: acc = num(a); pc += 2; break;\n"
+	"\t\tcase 0x2: store(a, acc); pc += 2; break;\n"
+	"\t\tcase 0x3: acc = (int)((unsigned)acc + (unsigned)num(a)); pc += 2; break;\n"
+	"\t\tcase 0x4: acc = (int)((unsigned)acc - (unsigned)num(a)); pc += 2; break;\n"
+	"\t\tcase 0x5: pc = a; break;\n"
+	"\t\tcase 0x6: if (push((pc + 2) & 0xFFFF)) { raised(\"stack overflow\\n\"); return; } pc = a; break;\n"
+	"\t\tcase 0x7: acc = (int)((unsigned)acc * (unsigned)num(a)); pc += 2; break;\n"
+	"\t\tcase 0x9: pc = (lazy && acc == 0) ? a : pc + 2; break;\n"
+	"\t\tcase 0xA: pc = (lazy && acc < 0) ? a : pc + 2; break;\n"
+	"\t\tcase 0xB: prt(a); pc += 2; break;\n"
+	"\t\tcase 0xC: put((int)a); pc += 2; break;\n"
+	"\t\tcase 0xD: prs(a); pc += 2; break;\n"
+	"\t\tcase 0x8:\n"
+	"\t\t\tif (a == 0x002) { acc = (int)((unsigned)acc + 1u); pc += 2; break; }\n"
+	"\t\t\tif (a == 0x000) return;\n"
+	"\t\t\tif (a == 0x001) {\n"
+	"\t\t\t\tif (pop(&n)) { raised(\"stack underflow\\n\"); return; }\n"
+	"\t\t\t\tif (n + 1 >= MEM_SIZE && n != CODE_END) { raised(\"bad return address\\n\"); return; }\n"
+	"\t\t\t\tpc = n; break;\n"
+	"\t\t\t}\n"
+	"\t\t\tif (a == 0x003) { if (push(enc(acc))) { raised(\"stack overflow\\n\"); return; } pc += 2; break; }\n"
+	"\t\t\tif (a == 0x004) { if (pop(&n)) { raised(\"stack underflow\\n\"); return; } acc = dec(n); pc += 2; break; }\n"
+	"\t\t\t/* fall through */\n"
+	"\t\tdefault: raised(\"else raised\\n\"); return;\n"
+	"\t\t}\n"
+	"\t\tlazy = 1;\n"
+	"\t}\n"
+	"}\n";
+
+// Is pc the first instruction of a compiled block
+static int aotLabel(Cfg *g, UINT pc) {
+	return codeAt(g->vm, pc) && g->seen[pc] && g->leader[pc];
+}
+
+// Jump to pc
+static void aotGoto(FILE *fp, Cfg *g, UINT pc) {
+	if (aotLabel(g, pc)) fprintf(fp, "goto L_%04X;", pc);
+	else if (pc == g->vm->code_end) fprintf(fp, "goto done;");
+	else fprintf(fp, "{ pc = 0x%04X; goto fallback; }", pc);
+}
+
+// Statement of the instruction at p, return 1 if control never
+// falls through to p + 2
+static int aotInst(FILE *fp, Cfg *g, UINT p, int stack_in_code) {
+	AccComVM *vm = g->vm;
+	DecodedInst d = vm->decoded[p];
+	UINT a = d.operand;
+
+	fprintf(fp, "\t");
+	switch (d.op) {
+	case 0x1: fprintf(fp, "acc = num(0x%03X);", a); break;
+	case 0x2:
+		fprintf(fp, "store(0x%03X, acc);", a);
+		if (inCode(vm, a)) {		// self-modifying: interpret from here
+			fprintf(fp, " pc = 0x%04X; goto fallback;\n", p + 2);
+			return 1;
+		}
+		break;
+	case 0x3: fprintf(fp, "acc = (int)((unsigned)acc + (unsigned)num(0x%03X));", a); break;
+	case 0x4: fprintf(fp, "acc = (int)((unsigned)acc - (unsigned)num(0x%03X));", a); break;
+	case 0x7: fprintf(fp, "acc = (int)((unsigned)acc * (unsigned)num(0x%03X));", a); break;
+	case 0x5: aotGoto(fp, g, a); fprintf(fp, "\n"); return 1;
+	case 0x9: fprintf(fp, "if (acc == 0) "); aotGoto(fp, g, a); break;
+	case 0xA: fprintf(fp, "if (acc < 0) "); aotGoto(fp, g, a); break;
+	case 0xB: fprintf(fp, "prt(0x%03X);", a); break;
+	case 0xC: fprintf(fp, "put(0x%02X);", a & 0xFF); break;
+	case 0xD: fprintf(fp, "prs(0x%03X);", a); break;
+	case 0x6:
+		if (stack_in_code) break;
+		fprintf(fp, "if (push(0x%04X)) { raised(\"stack overflow\\n\"); goto done; } ", (p + 2) & 0xFFFF);
+		aotGoto(fp, g, a);
+		fprintf(fp, "\n");
+		return 1;
+	case 0x8:
+		if (a == 0x002) { fprintf(fp, "acc = (int)((unsigned)acc + 1u);"); break; }
+		if (a == 0x000) { fprintf(fp, "goto done;\n"); return 1; }
+		if (a == 0x001) {
+			fprintf(fp, "if (pop(&n)) { raised(\"stack underflow\\n\"); goto done; }\n"
+				"\tif (n + 1 >= MEM_SIZE && n != CODE_END) { raised(\"bad return address\\n\"); goto done; }\n"
+				"\tpc = n; goto dispatch;\n");
+			return 1;
+		}
+		if (a == 0x003 && !stack_in_code) { fprintf(fp, "if (push(enc(acc))) { raised(\"stack overflow\\n\"); goto done; }"); break; }
+		if (a == 0x004) { fprintf(fp, "if (pop(&n)) { raised(\"stack underflow\\n\"); goto done; } acc = dec(n);"); break; }
+		if (a == 0x003) break;
+		// fall through
+	default:
+		fprintf(fp, "raised(\"else raised\\n\"); goto done;\n");
+		return 1;
+	}
+	if ((d.op == 0x6 || (d.op == 0x8 && a == 0x003)) && stack_in_code) {
+		fprintf(fp, "pc = 0x%04X; goto fallback;\n", p);		// push may write into CODE
+		return 1;
+	}
+	fprintf(fp, "\n");
+	return 0;
+}
+
+// -aot: write the loaded program as C, return 0 on success
+int recompile(AccComVM *vm, UINT entry, const char *path) {
+	Cfg g;
+	FILE *fp = fopen(path, "w");
+	const InputVar *v;
+	UINT p, lo, hi;
+	int i, addr, stack_in_code, ends = 0;
+
+	if (fp == NULL) {
+		fprintf(stderr, "%s: cannot write\n", path);
+		return 1;
+	}
+	cfgAlloc(&g, vm);
+	cfgBuild(&g, entry);
+	stack_in_code = vm->stack_bgn < vm->code_end && vm->code_bgn < vm->stack_end + 1;
+
+	fprintf(fp, "/* AccCom program recompiled by pyramid -aot\n"
+		"   build: cc -O2 -o prog %s; input variables are read from stdin */\n"
+		"#include <stdio.h>\n#include <string.h>\n\n", path);
+	fprintf(fp, "#define MEM_SIZE\t0x%X\n#define CODE_END\t0x%04X\n#define STACK_BGN\t0x%04X\n#define STACK_END\t0x%04X\n\n",
+		MEM_SIZE, vm->code_end, vm->stack_bgn, vm->stack_end);
+
+	// memory image: the nonzero part, the rest stays zero
+	for (lo = 0; lo < MEM_SIZE && vm->mem[lo] == 0; lo++) ;
+	for (hi = MEM_SIZE; hi > lo && vm->mem[hi - 1] == 0; hi--) ;
+	fprintf(fp, "static unsigned char mem[MEM_SIZE + 4];\t/* zero pad as in the simulator */\n");
+	fprintf(fp, "static const unsigned char image[] = {\t/* mem[0x%04X] ~ mem[0x%04X] */", lo, hi);
+	for (p = lo; p < hi; p++) fprintf(fp, "%s0x%02X,", (p - lo)%16 ? " " : "\n\t", vm->mem[p]);
+	fprintf(fp, "%s\n};\n\n", (hi == lo) ? "\n\t0" : "");
+
+	fprintf(fp, "static const struct { const char *name; unsigned addr; } input[] = {\n");
+	if (program == NULL) fprintf(fp, "\t{ \"Height\", 0x0100 },\n");
+	else for (v = input_var; v->name != NULL; v++)
+		if ((addr = inputAddr(vm, v->name)) >= 0) fprintf(fp, "\t{ \"%s\", 0x%04X },\n", v->name, addr);
+	fprintf(fp, "\t{ NULL, 0 }\n};\n\n%s\n", aot_runtime);
+
+	fprintf(fp, "static void run(void) {\n\tint acc = 0;\n\tunsigned pc, n;\n\n");
+	if (!aotLabel(&g, entry)) fprintf(fp, "\tinterp(0x%04X, 0, 0);\n\treturn;\n\n", entry);
+	else if (vm->decoded[entry].op == 0x9 || vm->decoded[entry].op == 0xA)
+		fprintf(fp, "\tpc = 0x%04X;\t/* first JZ/JN sees the initial PSW 0, 0 */\n\tgoto dispatch;\n\n", entry + 2);
+	else fprintf(fp, "\tpc = 0x%04X;\n\tgoto dispatch;\n\n", entry);
+
+	for (i = 0; i < g.nb; i++) {
+		fprintf(fp, "L_%04X:\n", g.b[i].bgn);
+		for (p = g.b[i].bgn, ends = 0; p <= g.b[i].last && !ends; p += 2)
+			ends = aotInst(fp, &g, p, stack_in_code);
+		if (ends) continue;
+		p = g.b[i].last + 2;
+		if (i + 1 < g.nb && g.b[i + 1].bgn == p) continue;
+		fprintf(fp, "\t");
+		aotGoto(fp, &g, p);
+		fprintf(fp, "\n");
+	}
+
+	fprintf(fp, "\ndispatch:\n\tswitch (pc) {\n");
+	for (i = 0; i < g.nb; i++) fprintf(fp, "\tcase 0x%04X: goto L_%04X;\n", g.b[i].bgn, g.b[i].bgn);
+	fprintf(fp, "\tcase CODE_END: goto done;\n\tdefault: goto fallback;\n\t}\n");
+	fprintf(fp, "fallback:\n\tinterp(pc, acc, 1);\ndone:\n\t(void)n;\n}\n\n");
+
+	fprintf(fp, "int main(void) {\n\tint i, x;\n\n"
+		"\tmemcpy(mem + 0x%04X, image, sizeof(image));\n"
+		"\tfor (i = 0; input[i].name != NULL; i++) {\n"
+		"\t\tif (scanf(\"%%d\", &x) != 1) x = 0;\n"
+		"\t\tstore(input[i].addr, x);\n"
+		"\t}\n"
+		"\trun();\n\tflush();\n\treturn 0;\n}\n", lo);
+	cfgFree(&g);
+	if (fclose(fp) != 0) {
+		fprintf(stderr, "%s: write failed\n", path);
+		return 1;
+	}
+	fprintf(stderr, "%s: %d blocks from entry %04X\n", path, g.nb, entry);
+	return 0;
+}
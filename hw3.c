@@ -1,4 +1,19 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// Prime numbers in [a, b], a and b read from stdin
+//
+//   hw3 [-j threads] [-compat] [-legacy]
+//
+// - default: segmented Sieve of Eratosthenes, odd numbers only, one bit
+//   per odd number, segments split across threads
+// - output "prime : %d \n" per prime, in increasing order
+// - -compat: also print the numbers below 2 as primes, as the original
+//   trial division did
+// - -legacy: the original trial division, for comparison
 
 int a,b;
 int flag = 1;
@@ -39,12 +54,10 @@ void isPrime()
 	}
 }
 
-int main()
+void legacy()
 {
-	scanf("%d", &a);
-	scanf("%d", &b);
 	for (k = a; k <=b;k++)
-	{	
+	{
 		//printf("k point : %d\n", k);
 		flag = 1;
 		z = k;
@@ -53,6 +66,231 @@ int main()
 		//printf("number k : %d flag : %d\n", k, flag);
 
 	}
+}
+
+//========================================
+// Segmented sieve
+//========================================
+#define SEG_BITS	(32*1024*8)		// odd numbers per segment: 32 KiB bitset, fits L1/L2
+#define SEG_SPAN	(2LL*SEG_BITS)	// numbers per segment
+#define SEG_ROUND	64				// max segments in flight
+#define LINE_MAX	24				// "prime : -2147483648 \n"
+
+typedef struct {
+	long long lo, hi;		// numbers lo ~ hi - 1
+	unsigned char bits[SEG_BITS/8];	// bit j: lo + 2j (lo odd) is composite
+	char  *out;				// formatted lines
+	size_t len;
+} Segment;
+
+int *base;		// odd primes up to sqrt(b)
+int nbase;
+
+// Odd primes p with p*p <= n by a plain sieve
+void basePrimes(int n)
+{
+	int m = 1, p, q;
+	char *comp;
+
+	while ((long long)(m + 1)*(m + 1) <= n) m++;	// m = floor(sqrt(n))
+	comp = calloc(m + 1, 1);
+	base = malloc((m/2 + 1)*sizeof(int));
+	if (comp == NULL || base == NULL) {
+		printf("Error: out of memory");
+		exit(-1);
+	}
+	nbase = 0;
+	for (p = 3; p <= m; p += 2) {
+		if (comp[p]) continue;
+		base[nbase++] = p;
+		for (q = p*p; q <= m; q += 2*p) comp[q] = 1;
+	}
+	free(comp);
+}
+
+// Max # of primes among y consecutive numbers
+// - pi(x + y) - pi(x) <= 2y/ln y for y > 1 (Montgomery-Vaughan),
+//   with ln y >= 0.693*floor(log2 y)
+static long long maxPrimes(long long y)
+{
+	int lg = 0;
+
+	if (y < 16) return y/2 + 1;
+	while ((2LL << lg) <= y) lg++;		// lg = floor(log2 y)
+	return 2*y*1000/(693LL*lg) + 1;
+}
+
+// Length of "prime : n \n" for 0 <= n <= max
+static int lineLen(long long max)
+{
+	int len = 11;
+
+	for (; max >= 10; max /= 10) len++;
+	return len;
+}
+
+// Append "prime : n \n"
+static char *putPrime(char *s, long long n)
+{
+	char digit[20];
+	int len = 0;
+	unsigned long long u = (n < 0) ? -(unsigned long long)n : (unsigned long long)n;
+
+	memcpy(s, "prime : ", 8);
+	s += 8;
+	if (n < 0) *s++ = '-';
+	do { digit[len++] = (char)('0' + u%10); u /= 10; } while (u != 0);
+	while (len > 0) *s++ = digit[--len];
+	*s++ = ' ';
+	*s++ = '\n';
+	return s;
+}
+
+// Sieve seg->lo ~ seg->hi - 1 (lo odd) and format its primes
+void sieveSegment(Segment *seg)
+{
+	long long lo = seg->lo, hi = seg->hi, start;
+	long long nbits = (hi - lo + 1)/2;
+	int i, p;
+	long long j;
+	char *s;
+
+	memset(seg->bits, 0, (nbits + 7)/8);
+	for (i = 0; i < nbase; i++) {
+		p = base[i];
+		if ((long long)p*p >= hi) break;
+		start = (long long)p*p;
+		if (start < lo) {
+			start = (lo + p - 1)/p*p;
+			if (start%2 == 0) start += p;		// odd multiples only
+		}
+		for (j = (start - lo)/2; j < nbits; j += p)
+			seg->bits[j >> 3] |= (unsigned char)(1 << (j & 7));
+	}
+
+	s = seg->out;
+	for (j = 0; j < nbits; j++) {
+		if (seg->bits[j >> 3] & (1 << (j & 7))) continue;
+		s = putPrime(s, lo + 2*j);
+	}
+	seg->len = s - seg->out;
+}
+
+typedef struct {
+	Segment *seg;
+	int      count;
+	int      next;		// next segment to take
+	pthread_mutex_t lock;
+} SievePool;
+
+static void *sieveWorker(void *arg)
+{
+	SievePool *pool = arg;
+	int i;
+
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		i = (pool->next < pool->count) ? pool->next++ : -1;
+		pthread_mutex_unlock(&pool->lock);
+		if (i < 0) break;
+		sieveSegment(&pool->seg[i]);
+	}
+	return NULL;
+}
+
+// Primes in [a, b] on threads, printed in order
+// - segments are sieved in rounds of 4 per thread (at most SEG_ROUND),
+//   each round is printed before the next starts
+// - the output buffer of a segment holds as many lines as a segment
+//   can have primes (maxPrimes()), each as long as the line of b
+void sieve(int threads, int compat)
+{
+	static char buf[1 << 16];
+	SievePool pool;
+	pthread_t *tid;
+	long long lo, n;
+	size_t len = 0, cap;
+	int i, round = (4*threads < SEG_ROUND) ? 4*threads : SEG_ROUND;
+
+	if (a > b) return;
+	// -compat, numbers below 2: the trial division never finds a divisor
+	if (compat) {
+		for (n = a; n < 2 && n <= b; n++) {
+			if (len + LINE_MAX > sizeof(buf)) { fwrite(buf, 1, len, stdout); len = 0; }
+			len = putPrime(buf + len, n) - buf;
+		}
+	}
+	if (a <= 2 && b >= 2) {
+		if (len + LINE_MAX > sizeof(buf)) { fwrite(buf, 1, len, stdout); len = 0; }
+		len = putPrime(buf + len, 2) - buf;
+	}
+	fwrite(buf, 1, len, stdout);
+	if (b < 3) return;
+
+	lo = (a < 3) ? 3 : ((a%2 == 0) ? (long long)a + 1 : a);	// first odd number >= 3
+	n = (b - lo + 1 < SEG_SPAN) ? b - lo + 1 : SEG_SPAN;		// numbers per segment
+	cap = (size_t)(maxPrimes(n)*lineLen(b));
+	basePrimes(b);
+	pool.seg = calloc(round, sizeof(Segment));
+	tid = calloc(threads, sizeof(pthread_t));
+	if (pool.seg == NULL || tid == NULL) {
+		printf("Error: out of memory");
+		exit(-1);
+	}
+	for (i = 0; i < round; i++) {
+		pool.seg[i].out = malloc(cap);
+		if (pool.seg[i].out == NULL) {
+			printf("Error: out of memory");
+			exit(-1);
+		}
+	}
+	pthread_mutex_init(&pool.lock, NULL);
+
+	while (lo <= b) {
+		for (pool.count = 0; pool.count < round && lo <= b; pool.count++) {
+			pool.seg[pool.count].lo = lo;
+			pool.seg[pool.count].hi = (lo + SEG_SPAN <= b) ? lo + SEG_SPAN : (long long)b + 1;
+			lo += SEG_SPAN;
+		}
+		pool.next = 0;
+		if (threads == 1 || pool.count == 1) sieveWorker(&pool);
+		else {
+			for (i = 0; i < threads; i++) pthread_create(&tid[i], NULL, sieveWorker, &pool);
+			for (i = 0; i < threads; i++) pthread_join(tid[i], NULL);
+		}
+		for (i = 0; i < pool.count; i++) fwrite(pool.seg[i].out, 1, pool.seg[i].len, stdout);
+	}
+
+	pthread_mutex_destroy(&pool.lock);
+	for (i = 0; i < round; i++) free(pool.seg[i].out);
+	free(pool.seg);
+	free(tid);
+	free(base);
+}
+
+int main(int argc, char *argv[])
+{
+	int threads = 0;	// 0: # of cores
+	int compat = 0;		// print numbers below 2 as primes
+	int use_legacy = 0;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) threads = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-compat") == 0) compat = 1;
+		else if (strcmp(argv[i], "-legacy") == 0) use_legacy = 1;
+		else {
+			fprintf(stderr, "usage: %s [-j threads] [-compat] [-legacy]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (threads < 1) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads < 1) threads = 1;
+
+	scanf("%d", &a);
+	scanf("%d", &b);
+	if (use_legacy) legacy();
+	else sieve(threads, compat);
 
 	return 0;
 
@@ -0,0 +1,450 @@
+/*
+ * peephole.c - peephole optimizer of AccCom program images (-opt)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "accvm.h"
+
+//========================================
+// Peephole optimizer
+// - -opt image: optimize the loaded program into a new image file,
+//   DATA stays where it is, CODE is compacted
+// - constant folding: LDA/IAC/ADD/SUB/MUL on read-only DATA words
+//   becomes one LDA of a word holding the result (appended to DATA
+//   if none has it)
+// - loads after stores: STA x; LDA x drops the LDA while ACC is
+//   known to fit a word, LDA x; LDA y drops the first LDA
+// - jump threading: jumps to JMP go to its target, jumps to the
+//   next instruction and unreachable instructions are dropped
+// - branch targets, the entry and CODE labels are relocated after
+//   deletions; CALL return addresses follow by themselves
+// - programs that store into CODE section, read it as data or keep
+//   the stack in it are left alone; with PUSH/POP and CALL together
+//   (return addresses visible as numbers) nothing is deleted
+// - -opt-verify runs the original and the optimized program on the
+//   same input and compares output, DATA and ACC
+//========================================
+typedef struct {
+	AccComVM *vm;
+	UINT entry;
+	int  n;					// # of instruction slots in CODE section
+	DecodedInst *inst;		// instruction of slot i at code_bgn + 2i
+	UCHAR *drop;			// slot deleted
+	UCHAR *leader;			// slot is a jump target, a return address or the entry
+	UCHAR  ro[MEM_SIZE];	// read-only DATA word at even offset from data_bgn
+	UINT   data_end;		// DATA section with appended constants
+	UCHAR  data[MEM_SIZE];	// DATA bytes with appended constants
+	int    relocatable;		// slots may be deleted
+	int    grow;			// constants may be appended to DATA
+	int    folds, folded, loads, threads, dead;	// report
+} Peephole;
+
+static int optSlot(Peephole *o, UINT pc) {
+	return (pc - o->vm->code_bgn)/2;
+}
+
+static int isJump(DecodedInst d) {
+	return d.op == 0x5 || d.op == 0x6 || d.op == 0x9 || d.op == 0xA;
+}
+
+// Is addr the first byte of an instruction slot
+static int optAligned(Peephole *o, UINT addr) {
+	return codeAt(o->vm, addr) && (addr - o->vm->code_bgn)%2 == 0;
+}
+
+// Check the program and find the read-only DATA words
+// - return NULL if it can be optimized, otherwise the reason
+static const char *optCheck(Peephole *o) {
+	AccComVM *vm = o->vm;
+	const InputVar *v;
+	UINT a, end;
+	int i, in, call = 0, stack = 0;
+
+	if ((vm->code_end - vm->code_bgn)%2 != 0) return "CODE section has an odd size";
+	if (vm->stack_bgn < vm->code_end && vm->code_bgn < vm->stack_end) return "the stack is inside CODE section";
+	if (!optAligned(o, o->entry)) return "entry is outside CODE section";
+	for (i = 0; i < o->n; i++) {
+		DecodedInst d = o->inst[i];
+		a = d.operand;
+		switch (d.op) {
+		case 0x1: case 0x2: case 0x3: case 0x4: case 0x7: case 0xB: case 0xD:
+			if (inCode(vm, a)) return (d.op == 0x2) ? "the program stores into CODE section" : "the program reads CODE section as data";
+			break;
+		case 0x5: case 0x6: case 0x9: case 0xA:
+			if (inCode(vm, a) && !optAligned(o, a)) return "a jump lands inside an instruction";
+			if (d.op == 0x6) call = 1;
+			break;
+		case 0x8:
+			if (d.operand == 0x001) call = 1;
+			if (d.operand == 0x003 || d.operand == 0x004) stack = 1;
+			break;
+		}
+	}
+	o->relocatable = !(call && stack);
+
+	// read-only: DATA words no STA writes, outside the stack and the input variables
+	memset(o->ro, 0, sizeof(o->ro));
+	for (a = vm->data_bgn; a + 2 <= vm->data_end; a += 2)
+		o->ro[a] = !(a < vm->stack_end && vm->stack_bgn < a + 2);
+	for (i = 0; i < o->n; i++) {
+		if (o->inst[i].op != 0x2) continue;
+		a = o->inst[i].operand;
+		if (a >= 1) o->ro[a - 1] = 0;
+		o->ro[a] = 0;
+		if (a + 1 < MEM_SIZE) o->ro[a + 1] = 0;
+	}
+	for (v = input_var; v->name != NULL; v++) {
+		if ((in = inputAddr(vm, v->name)) < 0) continue;
+		a = (UINT)in;
+		o->ro[a] = 0;
+		if (a >= 1) o->ro[a - 1] = 0;
+		if (a + 1 < MEM_SIZE) o->ro[a + 1] = 0;
+	}
+
+	// DATA may grow when no operand refers past its end and every PRS
+	// string ends in read-only DATA; optConst() keeps the new words
+	// clear of CODE and the stack
+	end = vm->data_end;
+	o->grow = 1;
+	for (i = 0; i < o->n && o->grow; i++) {
+		DecodedInst d = o->inst[i];
+		if (d.op == 0x0 || d.op == 0x8 || d.op == 0xC || d.op >= 0xE || isJump(d)) continue;
+		if (d.operand + 1 >= end) o->grow = 0;
+		for (a = d.operand; d.op == 0xD && o->grow; a++) {
+			if (a < vm->data_bgn || a >= end || !o->ro[a - (a - vm->data_bgn)%2]) o->grow = 0;
+			else if (vm->mem[a] == 0) break;
+		}
+	}
+	return NULL;
+}
+
+// Address of a read-only DATA word holding c, appended if needed, 0 if none
+static UINT optConst(Peephole *o, int c) {
+	AccComVM *vm = o->vm;
+	UINT a, n = cint2accnum(c);
+
+	for (a = vm->data_bgn; a + 2 <= vm->data_end; a += 2)
+		if (o->ro[a] && accnum2cint(readWord(vm, a)) == c) return a;
+	for (a = vm->data_end; a + 2 <= o->data_end; a += 2)
+		if (accnum2cint((o->data[a - vm->data_bgn] << 8) | o->data[a + 1 - vm->data_bgn]) == c) return a;
+	a = o->data_end;
+	if (!o->grow || a + 2 > MEM_SIZE || (a < vm->code_end && vm->code_bgn < a + 2) ||
+		(a < vm->stack_end && vm->stack_bgn < a + 2) || a > 0xFFE) return 0;
+	o->data[a - vm->data_bgn] = (UCHAR)(n >> 8);
+	o->data[a + 1 - vm->data_bgn] = (UCHAR)n;
+	o->data_end = a + 2;
+	return a;
+}
+
+// Next slot after i that is not deleted, n if none
+static int optNext(Peephole *o, int i) {
+	for (i++; i < o->n && o->drop[i]; i++) ;
+	return i;
+}
+
+// Mark jump targets, return addresses and the entry
+static void optLeaders(Peephole *o) {
+	int i;
+
+	memset(o->leader, 0, o->n);
+	o->leader[optSlot(o, o->entry)] = 1;
+	for (i = 0; i < o->n; i++) {
+		if (o->drop[i]) continue;
+		if (isJump(o->inst[i]) && optAligned(o, o->inst[i].operand)) o->leader[optSlot(o, o->inst[i].operand)] = 1;
+		if (o->inst[i].op == 0x6 && i + 1 < o->n) o->leader[i + 1] = 1;
+	}
+}
+
+// Jumps to JMP go to its final target
+static void optThread(Peephole *o) {
+	UINT t;
+	int i, k;
+
+	for (i = 0; i < o->n; i++) {
+		if (!isJump(o->inst[i])) continue;
+		t = o->inst[i].operand;
+		for (k = 0; k < o->n && optAligned(o, t) && o->inst[optSlot(o, t)].op == 0x5 &&
+			o->inst[optSlot(o, t)].operand != t; k++)
+			t = o->inst[optSlot(o, t)].operand;
+		if (k == o->n) continue;		// JMP cycle: leave it to run forever
+		if (t != o->inst[i].operand) {
+			o->inst[i].operand = t;
+			o->threads++;
+		}
+	}
+}
+
+// Fold LDA c; IAC/ADD c/SUB c/MUL c ... into LDA of the result
+static void optFold(Peephole *o) {
+	AccComVM *vm = o->vm;
+	long long c = 0;
+	int i, j, s = -1;
+	UINT k;
+
+	for (i = 0; i <= o->n; i++) {
+		DecodedInst d = (i < o->n) ? o->inst[i] : (DecodedInst){ 0, 0 };
+		int in = i < o->n && s >= 0 && !o->leader[i] &&
+			((d.op == 0x8 && d.operand == 0x002) ||
+			((d.op == 0x3 || d.op == 0x4 || d.op == 0x7) && o->ro[d.operand]));
+
+		if (in) {
+			if (d.op == 0x8) c += 1;
+			else if (d.op == 0x3) c += accnum2cint(readWord(vm, d.operand));
+			else if (d.op == 0x4) c -= accnum2cint(readWord(vm, d.operand));
+			else c *= accnum2cint(readWord(vm, d.operand));
+			if (c >= -0x7FFF && c <= 0x7FFF) continue;
+		}
+		// the sequence s ~ i - 1 ends here
+		if (s >= 0 && i - s >= 2 && !in && (k = optConst(o, (int)c)) != 0) {
+			o->inst[s].operand = k;
+			for (j = s + 1; j < i; j++) o->drop[j] = 1;
+			o->folds++;
+			o->folded += i - s - 1;
+		}
+		s = -1;
+		if (i < o->n && d.op == 0x1 && o->ro[d.operand]) {
+			s = i;
+			c = accnum2cint(readWord(vm, d.operand));
+		}
+	}
+}
+
+// Drop loads whose value ACC already holds or that are overwritten
+static void optLoads(Peephole *o) {
+	int i, j, word = 0;		// word: ACC came from memory, STA/LDA round-trips it
+
+	for (i = optNext(o, -1); i < o->n; i = j) {
+		DecodedInst d = o->inst[i];
+
+		j = optNext(o, i);
+		if (o->leader[i]) word = 0;
+		if (d.op == 0x1 && j < o->n && !o->leader[j] && o->inst[j].op == 0x1) {
+			o->drop[i] = 1;		// LDA x; LDA y
+			o->loads++;
+			continue;
+		}
+		if (d.op == 0x2 && word && j < o->n && !o->leader[j] &&
+			o->inst[j].op == 0x1 && o->inst[j].operand == d.operand) {
+			o->drop[j] = 1;		// STA x; LDA x
+			o->loads++;
+			j = optNext(o, j);
+			continue;
+		}
+		switch (d.op) {
+		case 0x1: word = 1; break;
+		case 0x2: case 0x9: case 0xA: case 0xB: case 0xC: case 0xD: break;
+		case 0x8: word = (d.operand == 0x004) || (word && d.operand == 0x003); break;
+		default: word = 0; break;
+		}
+	}
+}
+
+// Drop jumps to the next instruction and slots not reachable from the entry
+static void optDead(Peephole *o) {
+	AccComVM *vm = o->vm;
+	UCHAR *seen = o->leader;		// reused, leaders are rebuilt later
+	int *stack = malloc((o->n + 1)*sizeof(int));
+	int sp = 0, i, j, open = 0;
+	UINT next[2];
+	int k, nk;
+
+	if (stack == NULL) {
+		printf("Error: out of memory");
+		exit(-1);
+	}
+	for (i = 0; i < o->n; i++) {
+		DecodedInst d = o->inst[i];
+		if (i == optSlot(o, o->entry) || o->drop[i] || !(d.op == 0x5 || d.op == 0x9 || d.op == 0xA)) continue;
+		j = (d.operand == vm->code_end) ? o->n : optAligned(o, d.operand) ? optSlot(o, d.operand) : -1;
+		if (j > i && j <= optNext(o, i)) {		// lands where it would fall through
+			o->drop[i] = 1;
+			o->dead++;
+		}
+	}
+
+	memset(seen, 0, o->n);
+	stack[sp++] = optSlot(o, o->entry);
+	seen[stack[0]] = 1;
+	while (sp > 0) {
+		i = stack[--sp];
+		DecodedInst d = o->inst[i];
+		nk = 0;
+		j = optNext(o, i);
+		if (o->drop[i]) next[nk++] = vm->code_bgn + 2*j;
+		else switch (d.op) {
+		case 0x5: next[nk++] = d.operand; break;
+		case 0x6: case 0x9: case 0xA: next[nk++] = d.operand; next[nk++] = vm->code_bgn + 2*(i + 1); break;
+		case 0x0: case 0xE: case 0xF: break;
+		case 0x8: if (d.operand != 0x000 && d.operand != 0x001 && d.operand <= 0x004) next[nk++] = vm->code_bgn + 2*(i + 1); break;
+		default: next[nk++] = vm->code_bgn + 2*(i + 1); break;
+		}
+		for (k = 0; k < nk; k++) {
+			if (next[k] == vm->code_end) continue;
+			if (!optAligned(o, next[k])) { open = 1; continue; }	// runs outside CODE section
+			if (!seen[optSlot(o, next[k])]) {
+				seen[optSlot(o, next[k])] = 1;
+				stack[sp++] = optSlot(o, next[k]);
+			}
+		}
+	}
+	if (!open) {
+		for (i = 0; i < o->n; i++)
+			if (!seen[i] && !o->drop[i]) {
+				o->drop[i] = 1;
+				o->dead++;
+			}
+	}
+	free(stack);
+}
+
+// Optimize the program loaded in vm into out, return NULL or why not
+const char *optimize(AccComVM *vm, UINT entry, Program *out, Peephole *o) {
+	UINT *map;			// new address of each slot, [n]: code_end
+	const char *why;
+	UINT a;
+	int i, k;
+
+	memset(o, 0, sizeof(Peephole));
+	o->vm = vm;
+	o->entry = entry;
+	o->n = (vm->code_end - vm->code_bgn)/2;
+	o->inst = malloc((o->n + 1)*sizeof(DecodedInst));
+	o->drop = calloc(o->n + 1, 1);
+	o->leader = calloc(o->n + 1, 1);
+	map = malloc((o->n + 1)*sizeof(UINT));
+	if (o->inst == NULL || o->drop == NULL || o->leader == NULL || map == NULL) {
+		printf("Error: out of memory");
+		exit(-1);
+	}
+	for (i = 0; i < o->n; i++) o->inst[i] = vm->decoded[vm->code_bgn + 2*i];
+	memcpy(o->data, vm->mem + vm->data_bgn, vm->data_end - vm->data_bgn);
+	o->data_end = vm->data_end;
+
+	if ((why = optCheck(o)) == NULL) {
+		optThread(o);
+		if (o->relocatable) {
+			optLeaders(o);
+			optFold(o);
+			optLeaders(o);
+			optLoads(o);
+			optDead(o);
+		}
+	}
+
+	// relocate: slots keep their order, deleted ones map to the next kept
+	a = vm->code_bgn;
+	for (i = 0; i < o->n; i++) {
+		map[i] = a;
+		if (!o->drop[i]) a += 2;
+	}
+	map[o->n] = a;
+	for (i = o->n - 1; i >= 0; i--)
+		if (o->drop[i]) map[i] = map[i + 1];
+
+	memset(out, 0, sizeof(Program));
+	out->data_bgn = vm->data_bgn;
+	out->data_end = o->data_end;
+	out->code_bgn = vm->code_bgn;
+	out->code_end = map[o->n];
+	out->entry = (why == NULL) ? map[optSlot(o, entry)] : entry;
+	if (vm->stack_bgn != STACK_BGN || vm->stack_end != STACK_END) {
+		out->stack_bgn = vm->stack_bgn;
+		out->stack_end = vm->stack_end;
+	}
+	memcpy(out->mem + out->data_bgn, o->data, out->data_end - out->data_bgn);
+	for (i = k = 0; i < o->n; i++) {
+		DecodedInst d = o->inst[i];
+		if (o->drop[i]) continue;
+		if (why == NULL && isJump(d) && d.operand >= vm->code_bgn && d.operand <= vm->code_end)
+			d.operand = map[optSlot(o, d.operand)];
+		a = ((UINT)d.op << 12) | d.operand;
+		out->mem[out->code_bgn + 2*k] = (UCHAR)(a >> 8);
+		out->mem[out->code_bgn + 2*k + 1] = (UCHAR)a;
+		k++;
+	}
+	out->data = out->mem + out->data_bgn;
+	out->code = out->mem + out->code_bgn;
+	for (i = 0; i < vm->nsym && i < SYM_MAX; i++) {
+		out->symtab[i] = vm->sym[i];
+		a = out->symtab[i].addr;
+		if (why == NULL && a >= vm->code_bgn && a <= vm->code_end && (a - vm->code_bgn)%2 == 0)
+			out->symtab[i].addr = map[optSlot(o, a)];
+	}
+	out->sym = out->symtab;
+	out->nsym = i;
+
+	free(o->inst);
+	free(o->drop);
+	free(o->leader);
+	free(map);
+	return why;
+}
+
+// Run the original and the optimized program on the same input
+// - return 0 if output, DATA and ACC agree
+static int optVerify(AccComVM *vm, UINT entry, const Program *opt, unsigned long long count[2]) {
+	AccComVM *x = vm, *y = vmCreate();
+	UINT y_entry = programLoad(y, opt);
+	int ex, ey, same;
+
+	printf("*** Input ***\n");
+	inputData(x);
+	memcpy(y->mem + x->data_bgn, x->mem + x->data_bgn, x->data_end - x->data_bgn);
+#ifdef WORD_MEMORY
+	memcpy(y->num + x->data_bgn, x->num + x->data_bgn, (x->data_end - x->data_bgn)*sizeof(short));
+#endif
+	x->engine = y->engine = ENGINE_SWITCH;		// every instruction counted
+	x->accel = y->accel = 0;
+	sinkMemory(&x->out);
+	sinkMemory(&y->out);
+	ex = runProgram(x, entry);
+	ey = runProgram(y, y_entry);
+	count[0] = x->inst_count;
+	count[1] = y->inst_count;
+
+	same = ex == ey && x->acc == y->acc &&
+		x->out.mem_len == y->out.mem_len && memcmp(x->out.mem, y->out.mem, x->out.mem_len) == 0 &&
+		memcmp(x->mem + x->data_bgn, y->mem + x->data_bgn, x->data_end - x->data_bgn) == 0;
+	if (!same) {
+		printf("verify: mismatch:%s%s%s%s\n", (ex != ey) ? " exit" : "", (x->acc != y->acc) ? " ACC" : "",
+			(x->out.mem_len != y->out.mem_len || memcmp(x->out.mem, y->out.mem, x->out.mem_len) != 0) ? " output" : "",
+			memcmp(x->mem + x->data_bgn, y->mem + x->data_bgn, x->data_end - x->data_bgn) ? " DATA" : "");
+	}
+	vmDestroy(y);
+	return !same;
+}
+
+// -opt: write the optimized image and report, return exit code
+int peephole(const char *path, int verify) {
+	static Program opt;
+	static Peephole o;
+	AccComVM *vm = vmCreate();
+	UINT entry = loadProgram(vm);
+	unsigned long long count[2];
+	const char *why = optimize(vm, entry, &opt, &o);
+	UINT before = (vm->code_end - vm->code_bgn)/2, after = (opt.code_end - opt.code_bgn)/2;
+	int bad = 0;
+
+	if (why != NULL) printf("not optimized: %s\n", why);
+	else if (!o.relocatable) printf("no deletions: CALL/RET together with PUSH/POP\n");
+	printf("CODE %04X-%04X -> %04X-%04X, DATA %04X-%04X -> %04X-%04X\n",
+		vm->code_bgn, vm->code_end, opt.code_bgn, opt.code_end,
+		vm->data_bgn, vm->data_end, opt.data_bgn, opt.data_end);
+	printf("constant folds     %d (%d instructions)\n", o.folds, o.folded);
+	printf("loads dropped      %d\n", o.loads);
+	printf("jumps threaded     %d\n", o.threads);
+	printf("dead instructions  %d\n", o.dead);
+	printf("static             %u -> %u instructions (%+.1f%%)\n",
+		before, after, before ? 100.0*((double)after - before)/before : 0.0);
+	if (verify) {
+		bad = optVerify(vm, entry, &opt, count);
+		printf("dynamic            %llu -> %llu instructions (%+.1f%%)\n", count[0], count[1],
+			count[0] ? 100.0*((double)count[1] - count[0])/count[0] : 0.0);
+		printf("verify: %s\n", bad ? "FAILED" : "ok");
+	}
+	if (!bad && programWrite(&opt, path, 1)) bad = 1;
+	vmDestroy(vm);
+	return bad;
+}
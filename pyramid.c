@@ -10,63 +10,111 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include "accom.h"
+#include "accasm.h"
+#include "accvm.h"
+#if defined(__x86_64__) && defined(__linux__)
+#define JIT_X86_64			// native JIT backend available
+#define JIT_SIZE	(1 << 20)	// JIT code buffer size per machine
+#endif
 //#include <conio.h>
 
 //========================================
 // Global Definitions
 //========================================
 
-typedef unsigned char UCHAR;
-typedef unsigned int  UINT;
-
-#define MEM_SIZE	0x0FFF	// memory size
+// Memory backend, chosen at build time
+// - default: LDA/ADD/SUB/MUL convert big-endian sign-magnitude bytes
+//   on every access
+// - WORD_MEMORY (cc -DWORD_MEMORY): the number at every address is also
+//   kept decoded as a host short and read directly; the bytes stay the
+//   reference for PRS, code, images and dumps, since words may start at
+//   odd addresses and 0x8000 (-0, HLT) has no int value
 #define END_OF_ARG	0xFFFF	// end of argument
 
-UCHAR mem[MEM_SIZE];	// memory image
-
-UINT data_bgn;			// begin address of DATA section
-UINT data_end;			// end address of DATA section
-UINT code_bgn;			// begin address of CODE section
-UINT code_end;			// end address of CODE section
-
-int tos = 0;			// top of stack
-char instruction[10];
-int IR;
-int acc;
-int temp;
-int pc;
-int psw_zerobit;
-int psw_signbit;
-UINT temp_address;
-int data_address;
-char address[10];
-char address_to_int[10];
+const char *engine_name[ENGINE_COUNT] = { "switch", "table", "threaded", "block", "jit" };
+int engine = ENGINE_SWITCH;		// engine for new VMs (-e option)
+unsigned long long run_budget = 0;	// max instructions per run for new VMs, 0: none (-budget)
+double run_timeout = 0;				// max seconds per run for new VMs, 0: none (-timeout)
+int loop_accel = 0;					// run counted loops in one step for new VMs (-accel)
+
 //========================================
 // Utility Functions
 // for loadProgram(), inputData()
 //========================================
 
+void memTrap(AccComVM *vm, UINT addr);
+void invalidateCode(AccComVM *vm, UINT addr);
+
+// Trap word (CHECK_WORD) and byte (CHECK_BYTE) accesses outside memory
+#ifdef MEM_CHECK
+#define CHECK_WORD(vm, addr)	do { if ((addr) + 1 >= MEM_SIZE) memTrap(vm, addr); } while (0)
+#define CHECK_BYTE(vm, addr)	do { if ((addr) >= MEM_SIZE) memTrap(vm, addr); } while (0)
+#else
+#define CHECK_WORD(vm, addr)	((void)0)
+#define CHECK_BYTE(vm, addr)	((void)0)
+#endif
+
 // Read a word data from memory
-UINT readWord(UINT addr) {
-	return (mem[addr] << 8) | mem[addr + 1];
+UINT readWord(AccComVM *vm, UINT addr) {
+	return (vm->mem[addr] << 8) | vm->mem[addr + 1];
+}
+
+#ifdef WORD_MEMORY
+// Decode the number of the word at addr from bytes
+static inline short numDecode(AccComVM *vm, UINT addr) {
+	UINT n = readWord(vm, addr);
+	return (short)((n & 0x8000) ? -(int)(n & 0x7FFF) : (int)(n & 0x7FFF));
+}
+
+// Update numbers overlapping mem[addr], mem[addr+1] after a word write
+void numUpdate(AccComVM *vm, UINT addr) {
+	if (addr > 0) vm->num[addr - 1] = numDecode(vm, addr - 1);
+	vm->num[addr] = numDecode(vm, addr);
+	if (addr + 1 < MEM_SIZE) vm->num[addr + 1] = numDecode(vm, addr + 1);
 }
 
+// Rebuild all numbers after memory was copied in bulk
+void memSync(AccComVM *vm) {
+	UINT addr;
+
+	for (addr = 0; addr < MEM_SIZE; addr++)
+		vm->num[addr] = numDecode(vm, addr);
+}
+#else
+#define memSync(vm)		((void)0)
+#endif
+
 // Write a word data to memory
-void writeWord(UINT addr, UINT data) {
-	mem[addr	] = (UCHAR)((data & 0xFF00) >> 8);
-	mem[addr + 1] = (UCHAR) (data & 0x00FF);
+void writeWord(AccComVM *vm, UINT addr, UINT data) {
+	CHECK_WORD(vm, addr);
+	vm->mem[addr	] = (UCHAR)((data & 0xFF00) >> 8);
+	vm->mem[addr + 1] = (UCHAR) (data & 0x00FF);
+	vm->dirty[addr >> SNAP_SHIFT] = 1;
+	vm->dirty[(addr + 1) >> SNAP_SHIFT] = 1;
+#ifdef WORD_MEMORY
+	numUpdate(vm, addr);
+#endif
 }
 
 // Write variable # of words data to memory
 // readWord(addr)연산ㄹ을 사용해야 메모리의 값에 접근할 수 있다! -> 이걸 어떻게 정수형으로 바꿔서 처리하고 다시
 // 16진수로 할 수 있는지를 모르겠다.
-UINT writeWords(UINT addr, UINT data1, ...) {
+UINT writeWords(AccComVM *vm, UINT addr, UINT data1, ...) {
 	va_list ap;
 	UINT data;
 
 	va_start(ap, data1);
 	for (data = data1; data != END_OF_ARG; data = va_arg(ap, UINT)) {
-		writeWord(addr, data);
+		writeWord(vm, addr, data);
 		//printf("writeWords내의 addr 데이터 찍어보기 : %04X\n", addr);
 		//printf("mem에 들어가는 addr 그대로 찍어보기 : %04X\n", readWord(addr));
 		addr += 2;
@@ -77,7 +125,7 @@ UINT writeWords(UINT addr, UINT data1, ...) {
 }
 
 // Print memory addr1 ~ (addr2 - 1)
-void printMemory(char *name, UINT addr1, UINT addr2) {
+void printMemory(AccComVM *vm, char *name, UINT addr1, UINT addr2) {
 	const int COL = 8;	// column size
 	UINT addr;
 	int c = 0;
@@ -86,66 +134,322 @@ void printMemory(char *name, UINT addr1, UINT addr2) {
 
 	for (addr = addr1; addr < addr2; addr += 2) {
 		if (c == 0) printf("%04X:", addr);
-		printf(" %04X", readWord(addr));
+		printf(" %04X", readWord(vm, addr));
 		if (c == COL - 1) printf("\n");
 		c = (c + 1)%COL;
 	}
 	if (c != 0) printf("\n");
 }
 
-// Convert AccCom number to C int type
-int accnum2cint(UINT n) {
-	UINT sign_n = n & 0x8000;	// sign of n
-	UINT data_n = n & 0x7FFF;	// absolute value of n
-	int i = (sign_n ? -1 : 1)*data_n;
-	return i;
-}
-
-// Convert C int to AccCom number type
-UINT cint2accnum(int i) {
-	UINT sign_n = (UINT)((i < 0) ? 0x8000 : 0);
-	UINT data_n = (UINT)abs(i) & 0x7FFF;
-	UINT n = sign_n | data_n;
-	return n;
+// AccCom number at addr as C int
+static inline int loadNum(AccComVM *vm, UINT addr) {
+	CHECK_WORD(vm, addr);
+#ifdef WORD_MEMORY
+	return vm->num[addr];
+#else
+	return accnum2cint(readWord(vm, addr));
+#endif
 }
 
 // Scan a number and write to memory
-void inputNumber(char* msg, UINT addr) {
+void inputNumber(AccComVM *vm, char* msg, UINT addr) {
 	int n;
 
 	printf("%s", msg);
 	scanf("%d", &n);
-	writeWord(addr, cint2accnum(n));
+	writeWord(vm, addr, cint2accnum(n));
 }
 
 // stack push function
-// - stack area: mem[0] ~ mem[0x00FF]
-void push(UINT addr) {
-	if (tos == 0x00FFFF) {
-		printf("Error: Stack full");
-		exit(-1);
-	}
-	writeWord(tos, addr);
-	tos += 2;
+// - stack area: mem[stack_bgn] ~ mem[stack_end - 1], growing upward
+// - return -1 if the stack is full
+int push(AccComVM *vm, UINT data) {
+	if ((UINT)vm->tos + 2 > vm->stack_end) return -1;
+	writeWord(vm, vm->tos, data);
+	invalidateCode(vm, vm->tos);
+	vm->tos += 2;
+	return 0;
 }
 
 // stack pop function
-UINT pop() {
-	if (tos == 0) {
-		printf("Error: Stack empty");
+// - return -1 if the stack is empty
+int pop(AccComVM *vm, UINT *data) {
+	if ((UINT)vm->tos < vm->stack_bgn + 2) return -1;
+	vm->tos -= 2;
+	*data = readWord(vm, vm->tos);
+	return 0;
+}
+
+// Lazy PSW
+// - every instruction that writes ACC sets both flags from the new ACC
+//   alone, so after the first instruction of a run the flags are a
+//   function of ACC: engines set psw_lazy there and stop updating the
+//   bits; JZ/JN test ACC, snapshots, traces and the end of the run
+//   materialize the bits
+// - the first instruction may still read the bits left by a previous
+//   run, a reset or a snapshot, so runs start with psw_lazy = 0
+// - PSW_EAGER (cc -DPSW_EAGER): update the bits on every ACC write as
+//   well, the old cost, for comparing with -benchsuite
+// - updatePSW() is in accvm.h, the SIMT sweep uses it too
+
+#ifdef PSW_EAGER
+#define PSW_ACC(vm)		updatePSW(vm)
+#else
+#define PSW_ACC(vm)		((void)0)
+#endif
+
+// PSW zero / sign bit as the next JZ / JN sees it
+static inline int pswZero(AccComVM *vm) {
+	return vm->psw_lazy ? vm->acc == 0 : vm->psw_zerobit;
+}
+
+static inline int pswSign(AccComVM *vm) {
+	return vm->psw_lazy ? vm->acc < 0 : vm->psw_signbit;
+}
+
+// Materialize the PSW bits at the end of a run
+void pswSync(AccComVM *vm) {
+	if (!vm->psw_lazy) return;
+	updatePSW(vm);
+	vm->psw_lazy = 0;
+}
+
+//========================================
+// Output sink
+// - sinkFile(): stdio stream, sinkMemory(): memory buffer for tests
+//   and batch runs, sinkNull(): discard for benchmarks, counting bytes
+//========================================
+static void drainFile(OutputSink *sink, const char *data, size_t len) {
+	fwrite(data, 1, len, sink->fp);
+}
+
+static void drainMemory(OutputSink *sink, const char *data, size_t len) {
+	if (sink->mem_len + len > sink->mem_cap) {
+		while (sink->mem_len + len > sink->mem_cap)
+			sink->mem_cap = sink->mem_cap ? 2*sink->mem_cap : SINK_SIZE;
+		sink->mem = realloc(sink->mem, sink->mem_cap);
+		if (sink->mem == NULL) {
+			printf("Error: out of memory");
+			exit(-1);
+		}
+	}
+	memcpy(sink->mem + sink->mem_len, data, len);
+	sink->mem_len += len;
+}
+
+static void drainNull(OutputSink *sink, const char *data, size_t len) {
+	(void)data;
+	sink->dropped += len;
+}
+
+// Sink to a stdio stream
+void sinkFile(OutputSink *sink, FILE *fp) {
+	sink->drain = drainFile;
+	sink->fp = fp;
+	sink->len = 0;
+}
+
+// Sink to a growing memory buffer (sink->mem, sink->mem_len)
+void sinkMemory(OutputSink *sink) {
+	sink->drain = drainMemory;
+	sink->mem_len = 0;
+	sink->len = 0;
+}
+
+// Sink that discards everything
+void sinkNull(OutputSink *sink) {
+	sink->drain = drainNull;
+	sink->len = 0;
+}
+
+void sinkFlush(OutputSink *sink) {
+	if (sink->len > 0) sink->drain(sink, sink->buf, sink->len);
+	sink->len = 0;
+	if (sink->drain == drainFile) fflush(sink->fp);
+}
+
+// Drop buffered and collected output
+void sinkReset(OutputSink *sink) {
+	sink->len = 0;
+	sink->mem_len = 0;
+}
+
+void sinkFree(OutputSink *sink) {
+	free(sink->mem);
+	sink->mem = NULL;
+	sink->mem_len = sink->mem_cap = 0;
+}
+
+static inline void sinkPut(OutputSink *sink, int ch) {
+	if (sink->len == SINK_SIZE) sinkFlush(sink);
+	sink->buf[sink->len++] = (char)ch;
+}
+
+void sinkWrite(OutputSink *sink, const char *data, size_t len) {
+	if (sink->len + len > SINK_SIZE) {
+		sinkFlush(sink);
+		if (len > SINK_SIZE) {
+			sink->drain(sink, data, len);
+			return;
+		}
+	}
+	memcpy(sink->buf + sink->len, data, len);
+	sink->len += len;
+}
+
+// Write count copies of data (len <= SINK_SIZE)
+void sinkRepeat(OutputSink *sink, const char *data, size_t len, unsigned long long count) {
+	unsigned long long n;
+
+	if (len == 0) return;
+	while (count > 0) {
+		if (sink->len + len > SINK_SIZE) sinkFlush(sink);
+		n = (SINK_SIZE - sink->len)/len;
+		if (n > count) n = count;
+		count -= n;
+		if (len == 1) {
+			memset(sink->buf + sink->len, data[0], n);
+			sink->len += n;
+		}
+		else for (; n > 0; n--) {
+			memcpy(sink->buf + sink->len, data, len);
+			sink->len += len;
+		}
+	}
+}
+
+//========================================
+// Create / destroy a machine
+//========================================
+AccComVM *vmCreate() {
+	AccComVM *vm = calloc(1, sizeof(AccComVM));
+
+	if (vm == NULL) {
+		printf("Error: out of memory");
 		exit(-1);
 	}
-	tos -= 2;
-	return readWord(tos);
+	sinkFile(&vm->out, stdout);
+	vm->engine = engine;
+	vm->budget = run_budget;
+	vm->timeout = run_timeout;
+	vm->stack_bgn = STACK_BGN;
+	vm->stack_end = STACK_END;
+	vm->tos = STACK_BGN;
+	vm->accel = loop_accel;
+	return vm;
+}
+
+// Clear registers for a new run (memory is left as is)
+void vmReset(AccComVM *vm) {
+	vm->acc = 0;
+	vm->pc = 0;
+	vm->tos = vm->stack_bgn;
+	vm->psw_zerobit = 0;
+	vm->psw_signbit = 0;
+	vm->psw_lazy = 0;
+}
+
+void vmDestroy(AccComVM *vm) {
+#ifdef JIT_X86_64
+	if (vm->jit_buf != NULL) munmap(vm->jit_buf, JIT_SIZE);
+#endif
+	sinkFlush(&vm->out);
+	sinkFree(&vm->out);
+	free(vm->block_pool);
+	free(vm->loop_pool);
+	free(vm->prof);
+	free(vm->trace.rec);
+	if (vm->ckpt != NULL) fclose(vm->ckpt);
+	free(vm);
+}
+
+//========================================
+// Instruction decode
+// - CODE section is decoded once at load time
+// - STA into CODE section re-decodes the touched words
+//========================================
+
+// Split an instruction word into opcode and operand
+DecodedInst decodeWord(UINT ir) {
+	DecodedInst d;
+	d.op = (UCHAR)((ir >> 12) & 0xF);
+	d.operand = ir & 0x0FFF;
+	return d;
+}
+
+void jitFlush(AccComVM *vm);
+
+// Drop all compiled blocks
+void blockFlush(AccComVM *vm) {
+	memset(vm->block_at, 0, sizeof(vm->block_at));
+	vm->block_used = 0;
+	jitFlush(vm);
+}
+
+// Decode whole CODE section
+// - called after every bulk load of memory
+void decodeProgram(AccComVM *vm) {
+	UINT addr;
+
+	memSync(vm);
+	for (addr = vm->code_bgn; addr < vm->code_end; addr++)
+		vm->decoded[addr] = decodeWord(readWord(vm, addr));
+	vm->code_dirty = 0;
+	vm->loop_valid = 0;
+	blockFlush(vm);
+}
+
+// Re-decode words overlapping mem[addr], mem[addr+1] after a write
+void invalidateCode(AccComVM *vm, UINT addr) {
+	UINT a;
+
+	if (addr + 1 < vm->code_bgn || addr >= vm->code_end) return;
+	for (a = (addr > vm->code_bgn) ? addr - 1 : vm->code_bgn; a <= addr + 1 && a < vm->code_end; a++)
+		vm->decoded[a] = decodeWord(readWord(vm, a));
+	vm->code_dirty = 1;
+	blockFlush(vm);
+}
+
+// Fetch decoded instruction at pc
+// - outside CODE section (jump into DATA) decode directly from memory
+DecodedInst fetch(AccComVM *vm, UINT pc) {
+	if (pc >= vm->code_bgn && pc < vm->code_end) return vm->decoded[pc];
+	CHECK_WORD(vm, pc);
+	return decodeWord(readWord(vm, pc));
+}
+
+//========================================
+// Program image
+// - assembled program or image file (accasm.h) copied into a machine
+//========================================
+Program *program = NULL;	// -load: replaces the built-in program
+
+// Copy the sections into the machine, return start address
+// - cost depends on the section sizes only, symbols stay in place
+UINT programLoad(AccComVM *vm, const Program *prog) {
+	memset(vm->mem, 0, MEM_ALLOC);
+	memcpy(vm->mem + prog->data_bgn, prog->data, prog->data_end - prog->data_bgn);
+	memcpy(vm->mem + prog->code_bgn, prog->code, prog->code_end - prog->code_bgn);
+	vm->data_bgn = prog->data_bgn; vm->data_end = prog->data_end;
+	vm->code_bgn = prog->code_bgn; vm->code_end = prog->code_end;
+	vm->sym = prog->sym;
+	vm->nsym = prog->nsym;
+	vm->stack_bgn = (prog->stack_end != 0) ? prog->stack_bgn : STACK_BGN;
+	vm->stack_end = (prog->stack_end != 0) ? prog->stack_end : STACK_END;
+	vm->tos = vm->stack_bgn;
+	decodeProgram(vm);
+	return prog->entry;
 }
 
 //========================================
 // Load AccCom program to memory
 // - return start address of program
 //========================================
-UINT loadProgram() {
+UINT loadProgram(AccComVM *vm) {
+	if (program != NULL) return programLoad(vm, program);
+
 	// reset whole memory
-	memset(mem, 0, MEM_SIZE);
+	memset(vm->mem, 0, MEM_ALLOC);
 
 	/*
 		A=7		// input data
@@ -190,7 +494,7 @@ UINT loadProgram() {
 						//0x583D,	// 0108: STR 'X' '='
 						//0x0000,	// 010A:     '\0'
 						END_OF_ARG);*/
-	data_end = writeWords(data_bgn = 
+	vm->data_end = writeWords(vm, vm->data_bgn = 
 			0x0100,			0x0000,
 						0x0000,
 						0x0001,
@@ -200,7 +504,7 @@ UINT loadProgram() {
 						END_OF_ARG);
 
 	// CODE section ----------------------------------------
-	code_end = writeWords(code_bgn = 
+	vm->code_end = writeWords(vm, vm->code_bgn = 
 			0x0200,			0x1100,
 						0x2102,
 						0x1102,
@@ -317,17 +621,233 @@ UINT loadProgram() {
 
 	// -----------------------------------------------------
 
-	// print memory for verify
-	printMemory("DATA", data_bgn, data_end);
-	printMemory("CODE", code_bgn, code_end);
+	decodeProgram(vm);
+
+	return vm->code_bgn;	// return start address of program
+}
+
+//========================================
+// Memory image of a loaded program
+// - saved once after loadProgram(), restored before every batch run
+// - decode and block caches survive the restore unless the run
+//   wrote into CODE section
+//========================================
+typedef struct {
+	UCHAR mem[MEM_ALLOC];
+#ifdef WORD_MEMORY
+	short num[MEM_SIZE];
+#endif
+	UINT data_bgn, data_end;
+	UINT code_bgn, code_end;
+} MemImage;
+
+void imageSave(AccComVM *vm, MemImage *img) {
+	memcpy(img->mem, vm->mem, MEM_ALLOC);
+#ifdef WORD_MEMORY
+	memcpy(img->num, vm->num, sizeof(img->num));
+#endif
+	img->data_bgn = vm->data_bgn; img->data_end = vm->data_end;
+	img->code_bgn = vm->code_bgn; img->code_end = vm->code_end;
+}
+
+void imageRestore(AccComVM *vm, MemImage *img) {
+	int moved = vm->code_bgn != img->code_bgn || vm->code_end != img->code_end;
+
+	memcpy(vm->mem, img->mem, MEM_ALLOC);
+#ifdef WORD_MEMORY
+	memcpy(vm->num, img->num, sizeof(vm->num));
+#endif
+	vm->data_bgn = img->data_bgn; vm->data_end = img->data_end;
+	vm->code_bgn = img->code_bgn; vm->code_end = img->code_end;
+	if (moved || vm->code_dirty) decodeProgram(vm);
+	vmReset(vm);
+}
+
+//========================================
+// Snapshot of the whole machine
+// - memory, registers, PSW, stack region and section bounds
+// - a checkpoint file is a sequence of records: the first holds every
+//   page, each later one only the pages written since the record before
+// - snapshotRead() replays the records, a torn last record is dropped
+//========================================
+#define SNAP_MAGIC		0x4E534341	// "ACSN"
+#define SNAP_VERSION	1
+#define SNAP_EVERY		10000000ULL	// default checkpoint interval
+
+typedef struct {
+	UINT magic;				// SNAP_MAGIC
+	UINT version;			// SNAP_VERSION
+	UINT mem_size;			// MEM_SIZE of the writer
+	UINT npages;			// # of (UINT page, snapPageLen(page) bytes) after the header
+	int  acc, pc, tos;
+	UINT psw;				// bit 0 zero, bit 1 sign
+	UINT stack_bgn, stack_end;
+	UINT data_bgn, data_end;
+	UINT code_bgn, code_end;
+	unsigned long long inst_count;
+} SnapHeader;
+
+// Bytes of page p, SNAP_PAGE but for a short last page
+static inline UINT snapPageLen(UINT p) {
+	return (p + 1)*SNAP_PAGE <= MEM_SIZE ? SNAP_PAGE : MEM_SIZE - p*SNAP_PAGE;
+}
+
+// Append one record, full: all pages, else dirty pages only
+// - program output up to this point is flushed first, so a resumed run
+//   continues the output where the record was taken
+int snapshotWrite(AccComVM *vm, FILE *fp, int full) {
+	SnapHeader h;
+	UINT p;
+
+	sinkFlush(&vm->out);
+	memset(&h, 0, sizeof(h));
+	h.magic = SNAP_MAGIC;
+	h.version = SNAP_VERSION;
+	h.mem_size = MEM_SIZE;
+	for (p = 0; p < SNAP_PAGES; p++)
+		if (full || vm->dirty[p]) h.npages++;
+	h.acc = vm->acc; h.pc = vm->pc; h.tos = vm->tos;
+	h.psw = (UINT)(pswZero(vm) | (pswSign(vm) << 1));
+	h.stack_bgn = vm->stack_bgn; h.stack_end = vm->stack_end;
+	h.data_bgn = vm->data_bgn; h.data_end = vm->data_end;
+	h.code_bgn = vm->code_bgn; h.code_end = vm->code_end;
+	h.inst_count = vm->inst_count;
+
+	fwrite(&h, sizeof(h), 1, fp);
+	for (p = 0; p < SNAP_PAGES; p++) {
+		if (!full && !vm->dirty[p]) continue;
+		fwrite(&p, sizeof(p), 1, fp);
+		fwrite(vm->mem + p*SNAP_PAGE, 1, snapPageLen(p), fp);
+	}
+	memset(vm->dirty, 0, sizeof(vm->dirty));
+	fflush(fp);
+	return ferror(fp) ? 1 : 0;
+}
+
+static int snapHeaderOk(const SnapHeader *h) {
+	return h->magic == SNAP_MAGIC && h->version == SNAP_VERSION && h->mem_size == MEM_SIZE &&
+		h->npages <= SNAP_PAGES && (UINT)h->pc < MEM_SIZE && stackOk(h->stack_bgn, h->stack_end) &&
+		(UINT)h->tos >= h->stack_bgn && (UINT)h->tos <= h->stack_end &&
+		h->data_bgn <= h->data_end && h->data_end <= MEM_SIZE &&
+		h->code_bgn <= h->code_end && h->code_end <= MEM_SIZE;
+}
+
+// Restore the state of the last complete record of a checkpoint file
+int snapshotRead(AccComVM *vm, const char *path) {
+	FILE *fp = fopen(path, "rb");
+	SnapHeader h, last;
+	UCHAR *mem;
+	UINT i, p;
+	int records = 0, torn = 0;
+
+	memset(&last, 0, sizeof(last));
+	if (fp == NULL) {
+		fprintf(stderr, "%s: cannot open\n", path);
+		return 1;
+	}
+	mem = calloc(1, MEM_ALLOC);		// state of the records so far
+	if (mem == NULL) {
+		printf("Error: out of memory");
+		exit(-1);
+	}
+	while (fread(&h, sizeof(h), 1, fp) == 1) {
+		if (!snapHeaderOk(&h) || (records == 0 && h.npages != SNAP_PAGES)) {
+			fprintf(stderr, "%s: bad snapshot record %d\n", path, records);
+			fclose(fp);
+			free(mem);
+			return 1;
+		}
+		for (i = 0; i < h.npages; i++) {
+			if (fread(&p, sizeof(p), 1, fp) != 1 || p >= SNAP_PAGES ||
+				fread(mem + p*SNAP_PAGE, 1, snapPageLen(p), fp) != snapPageLen(p)) break;
+		}
+		if (i < h.npages) {
+			torn = 1;
+			break;
+		}
+		memcpy(vm->mem, mem, MEM_ALLOC);
+		last = h;
+		records++;
+	}
+	fclose(fp);
+	free(mem);
+	if (records == 0) {
+		fprintf(stderr, "%s: no snapshot\n", path);
+		return 1;
+	}
+	if (torn) fprintf(stderr, "%s: torn record %d dropped\n", path, records);
+
+	vm->acc = last.acc; vm->pc = last.pc; vm->tos = last.tos;
+	vm->psw_zerobit = last.psw & 1;
+	vm->psw_signbit = (last.psw >> 1) & 1;
+	vm->psw_lazy = 0;
+	vm->stack_bgn = last.stack_bgn; vm->stack_end = last.stack_end;
+	vm->data_bgn = last.data_bgn; vm->data_end = last.data_end;
+	vm->code_bgn = last.code_bgn; vm->code_end = last.code_end;
+	vm->inst_count = last.inst_count;
+	vm->sym = NULL;
+	vm->nsym = 0;
+	decodeProgram(vm);
+	memset(vm->dirty, 0, sizeof(vm->dirty));
+	return 0;
+}
+
+// Checkpoint the following runs of vm into path every `every` instructions
+int checkpointEnable(AccComVM *vm, const char *path, unsigned long long every) {
+	vm->ckpt = fopen(path, "wb");
+	if (vm->ckpt == NULL) {
+		fprintf(stderr, "%s: cannot write\n", path);
+		return 1;
+	}
+	vm->ckpt_every = every ? every : SNAP_EVERY;
+	return 0;
+}
 
-	return code_bgn;	// return start address of program
+//========================================
+// Input variables of the loaded program
+// - names for batch input lines (name=value)
+// - a program loaded with -load gives the addresses by its labels,
+//   the addresses below apply to programs without labels
+//========================================
+const InputVar input_var[] = {
+	{ "Height", 0x0100 },
+	{ NULL, 0 }
+};
+
+// Address of an input variable by name or hex address, -1 if unknown
+int inputAddr(AccComVM *vm, const char *name) {
+	const InputVar *v;
+	char *end;
+	UINT addr;
+	int sym_addr = symAddr(vm->sym, vm->nsym, name);
+
+	if (sym_addr >= 0) return sym_addr;
+	for (v = input_var; v->name != NULL && vm->nsym == 0; v++)
+		if (strcmp(v->name, name) == 0) return (int)v->addr;
+	addr = (UINT)strtoul(name, &end, 16);
+	if (*end == '\0' && end != name && addr + 1 < MEM_SIZE) return (int)addr;
+	return -1;
 }
 
 //========================================
 // Keyboard input for specific variables
 //========================================
-void inputData() {
+void inputData(AccComVM *vm) {
+	const InputVar *v;
+	char msg[SYM_NAME + 8];
+	int addr;
+
+	// loaded program: ask for the input variables it defines
+	if (program != NULL) {
+		for (v = input_var; v->name != NULL; v++) {
+			if ((addr = inputAddr(vm, v->name)) < 0) continue;
+			snprintf(msg, sizeof(msg), "%s = ", v->name);
+			inputNumber(vm, msg, (UINT)addr);
+		}
+		printMemory(vm, "DATA", vm->data_bgn, vm->data_end);
+		return;
+	}
+
 	// print problem summary
 	//printf("Y = AX^2 +BX + C\n");
 	
@@ -337,12 +857,12 @@ void inputData() {
 	//inputNumber("0104: C = ", 0x0104);
 	//inputNumber("0106: X = ", 0x0106);
 
-	inputNumber("Height = ", 0x0100);
+	inputNumber(vm, "Height = ", 0x0100);
 	//inputNumber("0102: B = ", 0x0102);
 	
 
 	// print DATA section for verify
-	printMemory("DATA", data_bgn, data_end);
+	printMemory(vm, "DATA", vm->data_bgn, vm->data_end);
 }
 
 //========================================
@@ -350,27 +870,48 @@ void inputData() {
 // for runProgram()
 //========================================
 
+// Out-of-range memory access (MEM_CHECK build)
+void memTrap(AccComVM *vm, UINT addr) {
+	sinkFlush(&vm->out);
+	fflush(stdout);
+	fprintf(stderr, "Error: address %04X out of memory (size %04X) at PC %04X IR %04X\n",
+		addr, MEM_SIZE, vm->pc, (vm->pc + 1 < MEM_SIZE) ? readWord(vm, vm->pc) : 0);
+	exit(-1);
+}
+
+static void elseRaised(AccComVM *vm) {
+	const char msg[] = "else raised\n";
+	sinkWrite(&vm->out, msg, sizeof(msg) - 1);
+}
+
 // PRT (PRinT) instruction
 // print a AccCom number at mem[addr]
-void prt(UINT addr) {
-	UINT n = readWord(addr);
+void prt(AccComVM *vm, UINT addr) {
+	UINT n;
+	CHECK_WORD(vm, addr);
+	n = readWord(vm, addr);
 	int i = accnum2cint(n);
-	printf("%d", i);
+	char str[16];
+
+	sinkWrite(&vm->out, str, snprintf(str, sizeof(str), "%d", i));
 }
 
 // PRC (PRint Char) instruction
 // print a ASCII char
-void prc(int ch) {
-	printf("%c", ch);
+void prc(AccComVM *vm, int ch) {
+	sinkPut(&vm->out, ch);
 }
 
 // PRS (PRint String) instruction
 // print string at mem[addr]
-void prs(UINT addr) {
-	int ch = (int)mem[addr];
+void prs(AccComVM *vm, UINT addr) {
+	int ch;
+	CHECK_BYTE(vm, addr);
+	ch = (int)vm->mem[addr];
 	while (ch != '\0') {
-		printf("%c", ch);
-		ch = (int)mem[++addr];
+		sinkPut(&vm->out, ch);
+		CHECK_BYTE(vm, addr + 1);
+		ch = (int)vm->mem[++addr];
 	}
 }
 
@@ -384,171 +925,2625 @@ void debug_exec(int acc)
 	printf(" <Exec> ACC:%04X\n", cint2accnum(acc));
 }
 
+#define RUN_CONTINUE	0	// step result: fetch next instruction
+#define RUN_EXIT		1	// step result: leave run loop
+
+#define EXIT_BUDGET		2	// runProgram(): instruction budget used up
+#define EXIT_TIMEOUT	3	// runProgram(): wall-clock limit reached
+
+// Stack fault: reported in the output like an invalid instruction
+static int stackRaised(AccComVM *vm, const char *msg) {
+	sinkWrite(&vm->out, msg, strlen(msg));
+	return RUN_EXIT;
+}
+
+// CALL (6xxx): push return address, jump to addr
+int callSub(AccComVM *vm, UINT addr) {
+	if (push(vm, (vm->pc + 2) & 0xFFFF) != 0) return stackRaised(vm, "stack overflow\n");
+	vm->pc = addr;
+	return RUN_CONTINUE;
+}
+
+// RET (8001): jump to popped return address
+// - the word may have been overwritten, an address outside memory
+//   faults here instead of at the next fetch
+int retSub(AccComVM *vm) {
+	UINT addr;
+
+	if (pop(vm, &addr) != 0) return stackRaised(vm, "stack underflow\n");
+	if (addr + 1 >= MEM_SIZE && addr != vm->code_end) return stackRaised(vm, "bad return address\n");
+	vm->pc = addr;
+	return RUN_CONTINUE;
+}
+
+// PUSH (8003): push ACC as AccCom number
+int pushAcc(AccComVM *vm) {
+	if (push(vm, cint2accnum(vm->acc)) != 0) return stackRaised(vm, "stack overflow\n");
+	vm->pc += 2;
+	return RUN_CONTINUE;
+}
+
+// POP (8004): pop ACC, PSW follows ACC
+int popAcc(AccComVM *vm) {
+	UINT n;
+
+	if (pop(vm, &n) != 0) return stackRaised(vm, "stack underflow\n");
+	vm->acc = accnum2cint(n);
+	PSW_ACC(vm);
+	vm->pc += 2;
+	return RUN_CONTINUE;
+}
+
+// Profiler shadow call stack
+// - a subroutine runs from the instruction after its CALL through its RET;
+//   callees count into its inclusive time only
+// - recursive calls count into every open frame of the subroutine
+static inline void profEnter(Profile *prof, UINT entry, Count now) {
+	if (prof->depth < PROF_DEPTH) {
+		prof->frame[prof->depth].entry = entry;
+		prof->frame[prof->depth].start = now;
+		prof->frame[prof->depth].child = 0;
+	}
+	prof->depth++;
+	prof->calls[entry]++;
+}
+
+static inline void profLeave(Profile *prof, Count now) {
+	Count incl;
+	UINT entry;
+
+	if (prof->depth == 0) return;		// RET without CALL in this run
+	if (--prof->depth >= PROF_DEPTH) return;
+	entry = prof->frame[prof->depth].entry;
+	incl = now - prof->frame[prof->depth].start;
+	prof->incl[entry] += incl;
+	prof->excl[entry] += incl - prof->frame[prof->depth].child;
+	if (prof->depth > 0) prof->frame[prof->depth - 1].child += incl;
+}
+
+// Close frames left open at the end of a run (HLT inside a subroutine)
+static void profUnwind(Profile *prof, Count now) {
+	while (prof->depth > 0) profLeave(prof, now);
+}
+
 //========================================
-// Run program
-// - addr: start address of program
-// - return exit state = 0: normal exit
-//                       1: error exit
+// Watchdog
+// - per-run instruction budget and wall-clock limit
+// - checked between blocks (per instruction when instrumented), so a
+//   run may overshoot the budget by one block; the clock is read every
+//   WATCH_CLOCK instructions
+// - a stopped run reports its PC and last block entries in the output
 //========================================
-int runProgram(UINT addr) {
-	pc = addr;
-	//for(int i= addr; i < code_end; i+= 2)
-	while(pc != code_end)
-        {
-            
-	    sprintf(instruction,"%02x%02x",mem[pc],mem[pc+1]);
-            sprintf(address, "%c%c%c", instruction[1],instruction[2],instruction[3]);
-	    UINT IR_address;
-	    IR_address = strtol(address, NULL, 16);
-	    //printf("PC : %x\n", pc);
-	    //printf("acc : %d %x\n", acc, pc);
-
-            for(int i =0; i < 4; i++)
-            {
-                if(instruction[i] >= 'a' && instruction[i] <= 'z')
-                    instruction[i] = instruction[i] - 32;
-            }
-
-            if(instruction[0] == '1') //LDA
-            {
-		    acc = accnum2cint(readWord(IR_address));
-		    pc+=2;
-            }
-
-            else if(instruction[0] == '2') //STA
-            {
-		writeWord(IR_address,cint2accnum(acc));
-		pc+=2;
-
-            }
-
-            else if(instruction[0] == '3') //ADD
-            {
-		temp = accnum2cint(readWord(IR_address));
-		acc += temp;
-		pc+=2;
-
-            }
-
-            else if(instruction[0] == '4') //SUB
-            {
-		temp = accnum2cint(readWord(IR_address));
-		acc -= temp;
-		pc+=2;
-            }
-
-            else if(instruction[0] == '5') //JMP Pass
-            {
-		pc = IR_address;
-            }
-
-            else if(instruction[0] == '7')
-            {
-		temp = accnum2cint(readWord(IR_address));
-		acc *= temp;
-		pc+=2;
-            }
-
-	    else if(instruction[0] == '9')
-	    {
-		if(psw_zerobit == 1)
-		{
-			pc = IR_address;
-		}
-		else{
-			pc+=2;
-		}
-	    }
-
-	    else if(instruction[0] == 'A')
-	    {
-		if(psw_signbit ==1)
-		{
-			pc = IR_address;
-
-		}
-		else{
-			pc +=2;
-		}
-	    }
-
-            else if(instruction[0] == 'B') //PRT
-            {
-		prt(IR_address);
-		pc+=2;
-
-            }
-
-            else if(instruction[0] == 'C') // PRC
-            {
-		temp = accnum2cint(readWord(IR_address));
-		prc(IR_address);
-		pc+=2;
-            }
-            else if(instruction[0] == 'D') // PRS
-            {
-		prs(IR_address);
-		pc+=2;
-
-            }
-
-            else if(strcmp(instruction,"8002") == 0)//IAC 누산기의 값 1증가
-            {
-		acc +=1;
-		pc+=2;
-            }
-
-            else if(strcmp(instruction,"8000")== 0) {
-		    pc+=2;
-		    return 0;
-            }
-	    else
-	    {
-		printf("else raised\n");
-		return 0;
-	    }
-
-	    if (acc == 0)
-	    {
-		psw_zerobit =1;
-	    }
-	    else
-	    {
-		psw_zerobit =0;
-	    }
-	    if(acc < 0)
-	    {
-		psw_signbit = 1;
-	    }
-	    else{
-		psw_signbit = 0;
-	    }
-	    
-
-        }
+typedef struct {
+	unsigned long long end;		// inst_count at which the budget is used up
+	unsigned long long clock;	// inst_count of the next clock read
+	double deadline;			// nowSeconds() at which the run times out
+} Watchdog;
+
+// Monotonic wall clock in seconds
+double nowSeconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static void watchStart(AccComVM *vm, Watchdog *w) {
+	w->end = vm->budget ? vm->inst_count + vm->budget : ~0ULL;
+	w->clock = (vm->timeout > 0) ? vm->inst_count + WATCH_CLOCK : ~0ULL;
+	w->deadline = (vm->timeout > 0) ? nowSeconds() + vm->timeout : 0;
+	vm->tail_pos = 0;
+}
+
+// inst_count of the next check
+static inline unsigned long long watchNext(const Watchdog *w) {
+	return (w->end < w->clock) ? w->end : w->clock;
+}
+
+// Record the entry pc of the next step
+static inline void watchTail(AccComVM *vm) {
+	vm->tail[vm->tail_pos++ % WATCH_TAIL] = (unsigned short)vm->pc;
+}
+
+static int watchRaised(AccComVM *vm, int exit_code) {
+	char msg[WATCH_TAIL*(SYM_NAME + 8) + 128];
+	const char *name;
+	UINT i, n, pc;
+	int len;
+
+	len = snprintf(msg, sizeof(msg), "%s at PC %04X, last blocks:",
+		(exit_code == EXIT_BUDGET) ? "instruction budget used up" : "timeout", vm->pc);
+	n = (vm->tail_pos < WATCH_TAIL) ? vm->tail_pos : WATCH_TAIL;
+	for (i = n; i > 0; i--) {
+		pc = vm->tail[(vm->tail_pos - i) % WATCH_TAIL];
+		name = symName(vm->sym, vm->nsym, pc);
+		len += snprintf(msg + len, sizeof(msg) - len, name ? " %04X(%s)" : " %04X", pc, name);
+	}
+	len += snprintf(msg + len, sizeof(msg) - len, "\n");
+	sinkWrite(&vm->out, msg, len);
+	return exit_code;
+}
+
+// Check budget and clock at inst_count >= watchNext()
+// - return 0 to go on, else EXIT_BUDGET or EXIT_TIMEOUT
+static int watchCheck(AccComVM *vm, Watchdog *w) {
+	if (vm->inst_count >= w->end) return watchRaised(vm, EXIT_BUDGET);
+	if (vm->inst_count >= w->clock) {
+		if (nowSeconds() >= w->deadline) return watchRaised(vm, EXIT_TIMEOUT);
+		w->clock = vm->inst_count + WATCH_CLOCK;
+	}
 	return 0;
 }
 
 //========================================
-// Main Function
+// ENGINE_SWITCH
+// - reference engine, PSW updated after every instruction
 //========================================
-int main() {
-	int exit_code;		// 0: normal exit, 1: error exit
-	UINT start_addr;	// start address of program
 
-	printf("========================================\n");
-	printf(" AccCom: Accumulator Computer Simulator\n");
-	printf("     modified by 201602141 Yoo Hwanseung\n");
-	printf("========================================\n");
+#ifdef __GNUC__
+#define ALWAYS_INLINE	inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE	inline
+#endif
+
+// Profiler hook, compiled out when prof is a constant NULL
+#define PROF(stmt)	do { if (prof != NULL) { stmt; } } while (0)
+
+// Execute one instruction
+// - prof: profile to update, NULL for a plain run
+static ALWAYS_INLINE int stepProfiled(AccComVM *vm, Profile *prof) {
+	DecodedInst ir;
+	UINT IR_address;
+
+	ir = fetch(vm, vm->pc);
+	IR_address = ir.operand;
+	vm->inst_count++;
+	PROF(
+		prof->at_pc[vm->pc]++;
+		if (prof->leader) prof->leader_at[vm->pc] = 1;
+		prof->leader = 0;
+		if (ir.op != 0x8) prof->op[ir.op]++;
+		else if (IR_address == 0x002) prof->op[PROF_IAC]++;
+		else if (IR_address == 0x000) prof->op[PROF_HLT]++;
+		else if (IR_address == 0x001) prof->op[PROF_RET]++;
+		else if (IR_address == 0x003) prof->op[PROF_PUSH]++;
+		else if (IR_address == 0x004) prof->op[PROF_POP]++;
+		else prof->op[0x8]++;
+		if (ir.op == 0x1 || ir.op == 0x3 || ir.op == 0x4 || ir.op == 0x7 ||
+			ir.op == 0xB || ir.op == 0xD) prof->reads[IR_address]++;
+		else if (ir.op == 0x2) prof->writes[IR_address]++;
+		else if (ir.op == 0x5 || ir.op == 0x6 || ir.op == 0x9 || ir.op == 0xA ||
+			(ir.op == 0x8 && IR_address == 0x001)) prof->leader = 1;
+	);
+
+	if (ir.op == 0x1) {				// LDA
+		vm->acc = loadNum(vm, IR_address);
+		vm->pc += 2;
+	}
+	else if (ir.op == 0x2) {		// STA
+		writeWord(vm, IR_address, cint2accnum(vm->acc));
+		invalidateCode(vm, IR_address);
+		vm->pc += 2;
+	}
+	else if (ir.op == 0x3) {		// ADD
+		vm->acc += loadNum(vm, IR_address);
+		vm->pc += 2;
+	}
+	else if (ir.op == 0x4) {		// SUB
+		vm->acc -= loadNum(vm, IR_address);
+		vm->pc += 2;
+	}
+	else if (ir.op == 0x5) {		// JMP
+		vm->pc = IR_address;
+	}
+	else if (ir.op == 0x6) {		// CALL
+		if (callSub(vm, IR_address) != RUN_CONTINUE) return RUN_EXIT;
+		PROF(profEnter(prof, IR_address, vm->inst_count));
+	}
+	else if (ir.op == 0x7) {		// MUL
+		vm->acc *= loadNum(vm, IR_address);
+		vm->pc += 2;
+	}
+	else if (ir.op == 0x9) {		// JZ
+		if (pswZero(vm)) { PROF(prof->taken[vm->pc]++); vm->pc = IR_address; }
+		else { PROF(prof->not_taken[vm->pc]++); vm->pc += 2; }
+	}
+	else if (ir.op == 0xA) {		// JN
+		if (pswSign(vm)) { PROF(prof->taken[vm->pc]++); vm->pc = IR_address; }
+		else { PROF(prof->not_taken[vm->pc]++); vm->pc += 2; }
+	}
+	else if (ir.op == 0xB) {		// PRT
+		prt(vm, IR_address);
+		vm->pc += 2;
+	}
+	else if (ir.op == 0xC) {		// PRC
+		prc(vm, IR_address);
+		vm->pc += 2;
+	}
+	else if (ir.op == 0xD) {		// PRS
+		prs(vm, IR_address);
+		vm->pc += 2;
+	}
+	else if (ir.op == 0x8 && IR_address == 0x002) {	// IAC 누산기의 값 1증가
+		vm->acc += 1;
+		vm->pc += 2;
+	}
+	else if (ir.op == 0x8 && IR_address == 0x000) {	// HLT
+		vm->pc += 2;
+		return RUN_EXIT;
+	}
+	else if (ir.op == 0x8 && IR_address == 0x001) {	// RET
+		if (retSub(vm) != RUN_CONTINUE) return RUN_EXIT;
+		PROF(profLeave(prof, vm->inst_count));
+	}
+	else if (ir.op == 0x8 && IR_address == 0x003) {	// PUSH
+		if (pushAcc(vm) != RUN_CONTINUE) return RUN_EXIT;
+	}
+	else if (ir.op == 0x8 && IR_address == 0x004) {	// POP
+		if (popAcc(vm) != RUN_CONTINUE) return RUN_EXIT;
+	}
+	else {
+		elseRaised(vm);
+		return RUN_EXIT;
+	}
+
+	PSW_ACC(vm);
+	vm->psw_lazy = 1;
+	return RUN_CONTINUE;
+}
+
+static inline int stepSwitch(AccComVM *vm) {
+	return stepProfiled(vm, NULL);
+}
+
+int runSwitch(AccComVM *vm, UINT addr) {
+	vm->pc = addr;
+	while (vm->pc != vm->code_end) {
+		if (stepSwitch(vm) != RUN_CONTINUE) break;
+	}
+	return 0;
+}
+
+//========================================
+// Profiler
+// - counts accumulate over all runs of a machine
+//========================================
+static const char *prof_op_name[PROF_OPS] = {
+	"OP0", "LDA", "STA", "ADD", "SUB", "JMP", "CALL", "MUL",
+	"OP8", "JZ",  "JN",  "PRT", "PRC", "PRS", "OPE", "OPF",
+	"IAC", "HLT", "RET", "PUSH", "POP"
+};
+
+typedef struct {
+	UINT  key;			// opcode index or address
+	Count count;		// sort key
+} ProfEntry;
+
+// Turn on profiling for the following runs
+void profileEnable(AccComVM *vm) {
+	if (vm->prof != NULL) return;
+	vm->prof = calloc(1, sizeof(Profile));
+	if (vm->prof == NULL) {
+		printf("Error: out of memory");
+		exit(-1);
+	}
+}
+
+// Descending count, then ascending key
+static int profCompare(const void *p, const void *q) {
+	const ProfEntry *a = p, *b = q;
+	if (a->count != b->count) return (a->count > b->count) ? -1 : 1;
+	return (a->key > b->key) - (a->key < b->key);
+}
+
+// Collect nonzero count1[i] + count2[i] sorted, count2 may be NULL
+static int profSort(ProfEntry *e, const Count *count1, const Count *count2, int n) {
+	int i, len = 0;
+
+	for (i = 0; i < n; i++) {
+		Count c = count1[i] + (count2 != NULL ? count2[i] : 0);
+		if (c == 0) continue;
+		e[len].key = (UINT)i;
+		e[len].count = c;
+		len++;
+	}
+	qsort(e, len, sizeof(ProfEntry), profCompare);
+	return len;
+}
+
+// Executions per basic block: a block runs as often as its leader
+static void profBlocks(Profile *prof, Count *block) {
+	int i;
+
+	for (i = 0; i < MEM_SIZE; i++)
+		block[i] = prof->leader_at[i] ? prof->at_pc[i] : 0;
+}
+
+static const char *profSection(AccComVM *vm, UINT addr) {
+	if (addr >= vm->data_bgn && addr < vm->data_end) return "DATA";
+	if (addr >= vm->code_bgn && addr < vm->code_end) return "CODE";
+	return "-";
+}
+
+// Label of addr: nearest label at or below addr, "" if none
+static const char *profLabel(AccComVM *vm, UINT addr) {
+	static char buf[SYM_NAME + 16];
+	const Symbol *best = NULL;
+	int i;
+
+	for (i = 0; i < vm->nsym; i++)
+		if (vm->sym[i].addr <= addr && (best == NULL || vm->sym[i].addr > best->addr)) best = &vm->sym[i];
+	if (best == NULL) return "";
+	if (best->addr == addr) return best->name;
+	snprintf(buf, sizeof(buf), "%s+%u", best->name, addr - best->addr);
+	return buf;
+}
+
+static double percent(Count c, Count total) {
+	return total ? 100.0*c/total : 0.0;
+}
 
-	printf("*** Load ***\n");
-	start_addr = loadProgram();
+// Text report, sorted by count
+// - top: max # of rows per table, 0: all
+void profileReport(AccComVM *vm, FILE *fp, int top) {
+	static ProfEntry e[MEM_SIZE];
+	static Count block[MEM_SIZE];
+	Profile *prof = vm->prof;
+	Count total = 0;
+	int i, n;
+
+	if (prof == NULL) return;
+	for (i = 0; i < PROF_OPS; i++) total += prof->op[i];
+	fprintf(fp, "*** Profile: %llu instructions (1 cycle each) ***\n", total);
+
+	fprintf(fp, "[opcode]\n");
+	n = profSort(e, prof->op, NULL, PROF_OPS);
+	for (i = 0; i < n; i++)
+		fprintf(fp, "  %-4s %12llu %6.2f%%\n", prof_op_name[e[i].key], e[i].count, percent(e[i].count, total));
+
+	fprintf(fp, "[pc]\n");
+	n = profSort(e, prof->at_pc, NULL, MEM_SIZE);
+	for (i = 0; i < n && (top == 0 || i < top); i++)
+		fprintf(fp, "  %04X: %04X %12llu %6.2f%%  %s\n", e[i].key, readWord(vm, e[i].key),
+			e[i].count, percent(e[i].count, total), profLabel(vm, e[i].key));
+
+	fprintf(fp, "[block]\n");
+	profBlocks(prof, block);
+	n = profSort(e, block, NULL, MEM_SIZE);
+	for (i = 0; i < n && (top == 0 || i < top); i++)
+		fprintf(fp, "  %04X %12llu  %s\n", e[i].key, e[i].count, profLabel(vm, e[i].key));
+
+	fprintf(fp, "[branch]            taken    not taken\n");
+	n = profSort(e, prof->taken, prof->not_taken, MEM_SIZE);
+	for (i = 0; i < n && (top == 0 || i < top); i++)
+		fprintf(fp, "  %04X %-3s %12llu %12llu  %s\n", e[i].key, prof_op_name[fetch(vm, e[i].key).op],
+			prof->taken[e[i].key], prof->not_taken[e[i].key], profLabel(vm, e[i].key));
+
+	fprintf(fp, "[memory]            reads       writes\n");
+	n = profSort(e, prof->reads, prof->writes, MEM_SIZE);
+	for (i = 0; i < n && (top == 0 || i < top); i++)
+		fprintf(fp, "  %04X %-4s %11llu %12llu  %s\n", e[i].key, profSection(vm, e[i].key),
+			prof->reads[e[i].key], prof->writes[e[i].key], profLabel(vm, e[i].key));
+
+	n = profSort(e, prof->incl, NULL, MEM_SIZE);
+	if (n == 0) return;
+	fprintf(fp, "[subroutine]        calls    inclusive    exclusive\n");
+	for (i = 0; i < n && (top == 0 || i < top); i++)
+		fprintf(fp, "  %04X %12llu %12llu %12llu  %s\n", e[i].key, prof->calls[e[i].key],
+			prof->incl[e[i].key], prof->excl[e[i].key], profLabel(vm, e[i].key));
+}
+
+// JSON report, same tables as profileReport() without row limit
+void profileJson(AccComVM *vm, FILE *fp) {
+	static ProfEntry e[MEM_SIZE];
+	static Count block[MEM_SIZE];
+	Profile *prof = vm->prof;
+	Count total = 0;
+	int i, n;
+
+	if (prof == NULL) return;
+	for (i = 0; i < PROF_OPS; i++) total += prof->op[i];
+	fprintf(fp, "{\n  \"instructions\": %llu,\n", total);
+
+	fprintf(fp, "  \"opcode\": [");
+	n = profSort(e, prof->op, NULL, PROF_OPS);
+	for (i = 0; i < n; i++)
+		fprintf(fp, "%s\n    {\"op\": \"%s\", \"count\": %llu}", i ? "," : "",
+			prof_op_name[e[i].key], e[i].count);
+	fprintf(fp, "\n  ],\n");
+
+	fprintf(fp, "  \"pc\": [");
+	n = profSort(e, prof->at_pc, NULL, MEM_SIZE);
+	for (i = 0; i < n; i++)
+		fprintf(fp, "%s\n    {\"pc\": %u, \"label\": \"%s\", \"ir\": %u, \"count\": %llu}", i ? "," : "",
+			e[i].key, profLabel(vm, e[i].key), readWord(vm, e[i].key), e[i].count);
+	fprintf(fp, "\n  ],\n");
+
+	fprintf(fp, "  \"block\": [");
+	profBlocks(prof, block);
+	n = profSort(e, block, NULL, MEM_SIZE);
+	for (i = 0; i < n; i++)
+		fprintf(fp, "%s\n    {\"pc\": %u, \"label\": \"%s\", \"count\": %llu}", i ? "," : "",
+			e[i].key, profLabel(vm, e[i].key), e[i].count);
+	fprintf(fp, "\n  ],\n");
+
+	fprintf(fp, "  \"branch\": [");
+	n = profSort(e, prof->taken, prof->not_taken, MEM_SIZE);
+	for (i = 0; i < n; i++)
+		fprintf(fp, "%s\n    {\"pc\": %u, \"label\": \"%s\", \"op\": \"%s\", \"taken\": %llu, \"not_taken\": %llu}",
+			i ? "," : "", e[i].key, profLabel(vm, e[i].key), prof_op_name[fetch(vm, e[i].key).op],
+			prof->taken[e[i].key], prof->not_taken[e[i].key]);
+	fprintf(fp, "\n  ],\n");
+
+	fprintf(fp, "  \"memory\": [");
+	n = profSort(e, prof->reads, prof->writes, MEM_SIZE);
+	for (i = 0; i < n; i++)
+		fprintf(fp, "%s\n    {\"addr\": %u, \"label\": \"%s\", \"section\": \"%s\", \"reads\": %llu, \"writes\": %llu}",
+			i ? "," : "", e[i].key, profLabel(vm, e[i].key), profSection(vm, e[i].key),
+			prof->reads[e[i].key], prof->writes[e[i].key]);
+	fprintf(fp, "\n  ],\n");
+
+	fprintf(fp, "  \"subroutine\": [");
+	n = profSort(e, prof->incl, NULL, MEM_SIZE);
+	for (i = 0; i < n; i++)
+		fprintf(fp, "%s\n    {\"pc\": %u, \"label\": \"%s\", \"calls\": %llu, \"inclusive\": %llu, \"exclusive\": %llu}",
+			i ? "," : "", e[i].key, profLabel(vm, e[i].key),
+			prof->calls[e[i].key], prof->incl[e[i].key], prof->excl[e[i].key]);
+	fprintf(fp, "\n  ]\n}\n");
+}
+
+//========================================
+// Trace ring buffer
+// - one binary record per instruction, no formatting on the hot path
+// - the ring keeps the last trace.mask + 1 records
+// - traceSave() writes them oldest first with the program labels,
+//   traceDecode() renders them in debug_fetch()/debug_exec() format
+//========================================
+#define TRACE_MAGIC		0x52544341	// "ACTR"
+#define TRACE_VERSION	2
+#define TRACE_SIZE		(1 << 16)	// default # of records
+
+typedef struct {
+	UINT magic;
+	UINT version;
+	UINT rec_size;			// sizeof(TraceRec)
+	UINT count;				// # of records in the file
+	unsigned long long total;	// # of records written, count are the last ones
+	UINT nsym;				// # of labels after the records
+	UINT pad;
+} TraceHeader;
+
+// Start tracing with a ring of at least size records
+void traceEnable(AccComVM *vm, UINT size) {
+	UINT n = 1;
+
+	while (n < size) n <<= 1;
+	free(vm->trace.rec);
+	vm->trace.rec = malloc(n*sizeof(TraceRec));
+	if (vm->trace.rec == NULL) {
+		printf("Error: out of memory");
+		exit(-1);
+	}
+	vm->trace.mask = n - 1;
+	vm->trace.pos = 0;
+}
+
+static inline TraceRec *traceBegin(AccComVM *vm) {
+	TraceRec *r = &vm->trace.rec[vm->trace.pos++ & vm->trace.mask];
+
+	r->pc = (unsigned short)vm->pc;
+	r->ir = (unsigned short)readWord(vm, vm->pc);
+	r->waddr = TRACE_NO_WRITE;
+	return r;
+}
+
+static inline void traceEnd(AccComVM *vm, TraceRec *r) {
+	r->acc = vm->acc;
+	r->psw = (UCHAR)(pswZero(vm) | (pswSign(vm) << 1));
+	if ((r->ir >> 12) == 0x2) {		// STA
+		r->waddr = r->ir & 0x0FFF;
+		r->wval = (unsigned short)readWord(vm, r->waddr);
+	}
+	else if (((r->ir >> 12) == 0x6 || r->ir == 0x8003) && vm->tos > (int)vm->stack_bgn &&
+		vm->pc != r->pc) {	// CALL, PUSH done
+		r->waddr = (unsigned short)(vm->tos - 2);
+		r->wval = (unsigned short)readWord(vm, r->waddr);
+	}
+}
 
-	printf("*** Input ***\n");
-	inputData();
+// Write the ring to path, oldest record first
+int traceSave(AccComVM *vm, const char *path) {
+	TraceRing *tr = &vm->trace;
+	TraceHeader h;
+	unsigned long long i, first;
+	FILE *fp;
+
+	if (tr->rec == NULL) return 0;
+	if ((fp = fopen(path, "wb")) == NULL) {
+		fprintf(stderr, "trace: cannot write %s\n", path);
+		return 1;
+	}
+	first = (tr->pos > tr->mask + 1ULL) ? tr->pos - (tr->mask + 1ULL) : 0;
+	h.magic = TRACE_MAGIC;
+	h.version = TRACE_VERSION;
+	h.rec_size = sizeof(TraceRec);
+	h.count = (UINT)(tr->pos - first);
+	h.total = tr->pos;
+	h.nsym = (UINT)vm->nsym;
+	h.pad = 0;
+	fwrite(&h, sizeof(h), 1, fp);
+	for (i = first; i < tr->pos; i++)
+		fwrite(&tr->rec[i & tr->mask], sizeof(TraceRec), 1, fp);
+	fwrite(vm->sym, sizeof(Symbol), vm->nsym, fp);
+	fclose(fp);
+	return 0;
+}
+
+// Print records of a trace file
+// - last: print only the last n matching records, 0: all
+// - pc_lo, pc_hi: print only records with pc_lo <= pc <= pc_hi
+int traceDecode(const char *path, UINT last, UINT pc_lo, UINT pc_hi) {
+	static Symbol sym[SYM_MAX];
+	TraceHeader h;
+	TraceRec *rec;
+	const char *label;
+	char ir[8];
+	UINT i, n, skip;
+	FILE *fp = fopen(path, "rb");
+
+	if (fp == NULL || fread(&h, sizeof(h), 1, fp) != 1 || h.magic != TRACE_MAGIC ||
+		h.version != TRACE_VERSION || h.rec_size != sizeof(TraceRec) || h.nsym > SYM_MAX) {
+		fprintf(stderr, "trace: %s is not a trace file\n", path);
+		if (fp != NULL) fclose(fp);
+		return 1;
+	}
+	rec = malloc((h.count ? h.count : 1)*sizeof(TraceRec));
+	if (rec == NULL || fread(rec, sizeof(TraceRec), h.count, fp) != h.count ||
+		fread(sym, sizeof(Symbol), h.nsym, fp) != h.nsym) {
+		fprintf(stderr, "trace: %s is truncated\n", path);
+		free(rec);
+		fclose(fp);
+		return 1;
+	}
+	fclose(fp);
+
+	for (i = n = 0; i < h.count; i++)
+		if (rec[i].pc >= pc_lo && rec[i].pc <= pc_hi) n++;
+	skip = (last != 0 && n > last) ? n - last : 0;
+
+	printf("*** Trace: %u of %llu records ***", n - skip, h.total);
+	for (i = 0; i < h.count; i++) {
+		if (rec[i].pc < pc_lo || rec[i].pc > pc_hi) continue;
+		if (skip > 0) { skip--; continue; }
+		snprintf(ir, sizeof(ir), "%04X", rec[i].ir);
+		if ((label = symName(sym, (int)h.nsym, rec[i].pc)) != NULL) printf("\n%s:", label);
+		debug_fetch(rec[i].pc, ir);
+		debug_exec(rec[i].acc);
+		if (rec[i].waddr != TRACE_NO_WRITE)
+			printf("%04X: %04X\n", rec[i].waddr, rec[i].wval);
+	}
+	printf("\n");
+	free(rec);
+	return 0;
+}
+
+//========================================
+// Instrumented run
+// - ENGINE_SWITCH step with profiler and trace hooks, used when
+//   either is enabled so that plain runs stay untouched
+//========================================
+int profile_text = 0;				// -profile: text report to stderr
+const char *profile_json = NULL;	// -profile-json: JSON report file, "-": stdout
+const char *trace_file = NULL;		// -trace: trace file
+UINT trace_size = TRACE_SIZE;		// -trace-size: # of records in the ring
+
+// Enable the hooks selected by the options above
+void instrumentEnable(AccComVM *vm) {
+	if (profile_text || profile_json != NULL) profileEnable(vm);
+	if (trace_file != NULL) traceEnable(vm, trace_size);
+}
+
+// Write profile reports and trace file after the runs
+void instrumentReport(AccComVM *vm) {
+	FILE *fp;
+
+	if (profile_text) profileReport(vm, stderr, 20);
+	if (profile_json != NULL) {
+		fp = (strcmp(profile_json, "-") == 0) ? stdout : fopen(profile_json, "w");
+		if (fp == NULL) fprintf(stderr, "profile: cannot write %s\n", profile_json);
+		else {
+			profileJson(vm, fp);
+			if (fp != stdout) fclose(fp);
+		}
+	}
+	if (trace_file != NULL) traceSave(vm, trace_file);
+}
+
+int runInstrumented(AccComVM *vm, UINT addr) {
+	Profile *prof = vm->prof;
+	TraceRec *r;
+	Watchdog w;
+	int exit_state, exit_code = 0;
+
+	vm->pc = addr;
+	watchStart(vm, &w);
+	if (prof != NULL) prof->leader = 1;
+	while (vm->pc != vm->code_end) {
+		watchTail(vm);
+		r = (vm->trace.rec != NULL) ? traceBegin(vm) : NULL;
+		exit_state = stepProfiled(vm, prof);
+		if (r != NULL) traceEnd(vm, r);
+		if (exit_state != RUN_CONTINUE) break;
+		if (vm->inst_count >= watchNext(&w) && (exit_code = watchCheck(vm, &w)) != 0) break;
+	}
+	if (prof != NULL) profUnwind(prof, vm->inst_count);
+	return exit_code;
+}
+
+//========================================
+// ENGINE_TABLE
+// - one handler per 4-bit opcode
+// - handlers update PSW only when ACC changes
+//========================================
+typedef int (*OpHandler)(AccComVM *vm, UINT operand);
+
+static int opLDA(AccComVM *vm, UINT a) { vm->acc = loadNum(vm, a); PSW_ACC(vm); vm->pc += 2; return RUN_CONTINUE; }
+static int opSTA(AccComVM *vm, UINT a) { writeWord(vm, a, cint2accnum(vm->acc)); invalidateCode(vm, a); vm->pc += 2; return RUN_CONTINUE; }
+static int opADD(AccComVM *vm, UINT a) { vm->acc += loadNum(vm, a); PSW_ACC(vm); vm->pc += 2; return RUN_CONTINUE; }
+static int opSUB(AccComVM *vm, UINT a) { vm->acc -= loadNum(vm, a); PSW_ACC(vm); vm->pc += 2; return RUN_CONTINUE; }
+static int opJMP(AccComVM *vm, UINT a) { vm->pc = a; return RUN_CONTINUE; }
+static int opMUL(AccComVM *vm, UINT a) { vm->acc *= loadNum(vm, a); PSW_ACC(vm); vm->pc += 2; return RUN_CONTINUE; }
+static int opJZ (AccComVM *vm, UINT a) { if (pswZero(vm)) vm->pc = a; else vm->pc += 2; return RUN_CONTINUE; }
+static int opJN (AccComVM *vm, UINT a) { if (pswSign(vm)) vm->pc = a; else vm->pc += 2; return RUN_CONTINUE; }
+static int opPRT(AccComVM *vm, UINT a) { prt(vm, a); vm->pc += 2; return RUN_CONTINUE; }
+static int opPRC(AccComVM *vm, UINT a) { prc(vm, a); vm->pc += 2; return RUN_CONTINUE; }
+static int opPRS(AccComVM *vm, UINT a) { prs(vm, a); vm->pc += 2; return RUN_CONTINUE; }
+
+static int opCALL(AccComVM *vm, UINT a) { return callSub(vm, a); }
+
+static int opBAD(AccComVM *vm, UINT a) {
+	(void)a;
+	elseRaised(vm);
+	return RUN_EXIT;
+}
+
+// opcode 8: HLT (8000), RET (8001), IAC (8002), PUSH (8003), POP (8004)
+static int opSYS(AccComVM *vm, UINT a) {
+	if (a == 0x002) { vm->acc += 1; PSW_ACC(vm); vm->pc += 2; return RUN_CONTINUE; }
+	if (a == 0x000) { vm->pc += 2; return RUN_EXIT; }
+	if (a == 0x001) return retSub(vm);
+	if (a == 0x003) return pushAcc(vm);
+	if (a == 0x004) return popAcc(vm);
+	return opBAD(vm, a);
+}
+
+const OpHandler op_table[16] = {
+	opBAD, opLDA, opSTA, opADD, opSUB, opJMP, opCALL, opMUL,
+	opSYS, opJZ,  opJN,  opPRT, opPRC, opPRS, opBAD, opBAD
+};
+
+// Execute one instruction through op_table
+static int stepTable(AccComVM *vm) {
+	DecodedInst ir = fetch(vm, vm->pc);
+	vm->inst_count++;
+	return op_table[ir.op](vm, ir.operand);
+}
+
+// Execute the first instruction of a run
+// - it may read the PSW left by a previous run; afterwards the flags
+//   follow ACC (psw_lazy), so engines never touch the bits
+static int stepFirst(AccComVM *vm) {
+	if (stepTable(vm) != RUN_CONTINUE) return RUN_EXIT;
+	PSW_ACC(vm);
+	vm->psw_lazy = 1;
+	return RUN_CONTINUE;
+}
+
+int runTable(AccComVM *vm, UINT addr) {
+	vm->pc = addr;
+	if (vm->pc == vm->code_end || stepFirst(vm) != RUN_CONTINUE) return 0;
+	while (vm->pc != vm->code_end) {
+		if (stepTable(vm) != RUN_CONTINUE) break;
+	}
+	return 0;
+}
+
+//========================================
+// ENGINE_THREADED
+// - threaded code with GCC computed goto
+//========================================
+#ifdef __GNUC__
+int runThreaded(AccComVM *vm, UINT addr) {
+	static void *label[16] = {
+		&&L_BAD, &&L_LDA, &&L_STA, &&L_ADD, &&L_SUB, &&L_JMP, &&L_CALL, &&L_MUL,
+		&&L_SYS, &&L_JZ,  &&L_JN,  &&L_PRT, &&L_PRC, &&L_PRS, &&L_BAD, &&L_BAD
+	};
+	DecodedInst ir;
+
+#define DISPATCH()	do {							\
+		if (vm->pc == vm->code_end) return 0;		\
+		ir = fetch(vm, vm->pc);						\
+		vm->inst_count++;							\
+		goto *label[ir.op];							\
+	} while (0)
+
+	vm->pc = addr;
+	if (vm->pc == vm->code_end || stepFirst(vm) != RUN_CONTINUE) return 0;
+	DISPATCH();
+
+L_LDA:	vm->acc = loadNum(vm, ir.operand); PSW_ACC(vm); vm->pc += 2; DISPATCH();
+L_STA:	writeWord(vm, ir.operand, cint2accnum(vm->acc)); invalidateCode(vm, ir.operand); vm->pc += 2; DISPATCH();
+L_ADD:	vm->acc += loadNum(vm, ir.operand); PSW_ACC(vm); vm->pc += 2; DISPATCH();
+L_SUB:	vm->acc -= loadNum(vm, ir.operand); PSW_ACC(vm); vm->pc += 2; DISPATCH();
+L_JMP:	vm->pc = ir.operand; DISPATCH();
+L_CALL:	if (callSub(vm, ir.operand) != RUN_CONTINUE) return 0; DISPATCH();
+L_MUL:	vm->acc *= loadNum(vm, ir.operand); PSW_ACC(vm); vm->pc += 2; DISPATCH();
+L_JZ:	if (vm->acc == 0) vm->pc = ir.operand; else vm->pc += 2; DISPATCH();
+L_JN:	if (vm->acc < 0) vm->pc = ir.operand; else vm->pc += 2; DISPATCH();
+L_PRT:	prt(vm, ir.operand); vm->pc += 2; DISPATCH();
+L_PRC:	prc(vm, ir.operand); vm->pc += 2; DISPATCH();
+L_PRS:	prs(vm, ir.operand); vm->pc += 2; DISPATCH();
+L_SYS:	if (ir.operand == 0x002) { vm->acc += 1; PSW_ACC(vm); vm->pc += 2; DISPATCH(); }
+		if (ir.operand == 0x000) { vm->pc += 2; return 0; }
+		if (ir.operand == 0x001) { if (retSub(vm) != RUN_CONTINUE) return 0; DISPATCH(); }
+		if (ir.operand == 0x003) { if (pushAcc(vm) != RUN_CONTINUE) return 0; DISPATCH(); }
+		if (ir.operand == 0x004) { if (popAcc(vm) != RUN_CONTINUE) return 0; DISPATCH(); }
+		// fall through
+L_BAD:	elseRaised(vm);
+		return 0;
+
+#undef DISPATCH
+}
+#else
+int runThreaded(AccComVM *vm, UINT addr) {
+	return runTable(vm, addr);
+}
+#endif
+
+//========================================
+// ENGINE_BLOCK
+// - straight-line runs ending at JMP/JZ/JN/HLT are compiled into blocks
+// - common sequences are fused into superinstructions
+// - blocks are cached by entry pc and flushed by STA into CODE section
+//========================================
+enum {
+	U_CALL,				// single instruction through op_table
+	U_LDA, U_STA, U_ADD, U_SUB, U_MUL, U_IAC,
+	U_STA_CODE,			// STA into CODE section, ends the block
+	U_JMP, U_JZ, U_JN,
+	U_LDA_STA,			// LDA a; STA b
+	U_LDA_IAC_STA,		// LDA a; IAC; STA b
+	U_LDA_SUB_JN,		// LDA a; SUB b; JN c
+	U_LDA_SUB_JZ,		// LDA a; SUB b; JZ c
+	U_SUB_JN			// SUB a; JN b
+};
+
+// Decoded instruction at p, invalid op past code_end
+static DecodedInst peek(AccComVM *vm, UINT p) {
+	DecodedInst d = { 0, 0 };
+	if (p < vm->code_end) d = vm->decoded[p];
+	return d;
+}
+
+static int isIAC(DecodedInst d) { return d.op == 0x8 && d.operand == 0x002; }
+
+// Memory operand of d inside the address space
+// - MEM_CHECK builds run the others through op_table, so that the trap
+//   sees the exact pc
+static int memOk(DecodedInst d) {
+#ifdef MEM_CHECK
+	switch (d.op) {
+	case 0x1: case 0x2: case 0x3: case 0x4: case 0x7: case 0xB:
+		return d.operand + 1 < MEM_SIZE;
+	}
+#else
+	(void)d;
+#endif
+	return 1;
+}
+
+// Compile the block starting at entry (entry must be inside CODE section)
+Block *compileBlock(AccComVM *vm, UINT entry) {
+	Block *b;
+	MicroOp *u;
+	DecodedInst d, d1, d2;
+	UINT p = entry;
+	int end = 0, fuse;
+
+	if (vm->block_pool == NULL) {
+		vm->block_pool = malloc(BLOCK_POOL*sizeof(Block));
+		if (vm->block_pool == NULL) {
+			printf("Error: out of memory");
+			exit(-1);
+		}
+	}
+	if (vm->block_used == BLOCK_POOL) blockFlush(vm);
+	b = &vm->block_pool[vm->block_used++];
+	b->entry = entry;
+	b->len = 0;
+
+	while (!end && p < vm->code_end && b->len < BLOCK_MAX) {
+		u = &b->op[b->len++];
+		d = vm->decoded[p];
+		d1 = peek(vm, p + 2);
+		d2 = peek(vm, p + 4);
+		u->a = d.operand;
+		u->n = 1;
+		fuse = memOk(d1) && memOk(d2);
+
+		if (!memOk(d)) {
+			u->uop = U_CALL; u->b = d.op; u->c = p; end = 1;
+		}
+		else if (fuse && d.op == 0x1 && isIAC(d1) && d2.op == 0x2 && !inCode(vm, d2.operand)) {
+			u->uop = U_LDA_IAC_STA; u->b = d2.operand; u->n = 3;
+		}
+		else if (fuse && d.op == 0x1 && d1.op == 0x4 && (d2.op == 0xA || d2.op == 0x9)) {
+			u->uop = (d2.op == 0xA) ? U_LDA_SUB_JN : U_LDA_SUB_JZ;
+			u->b = d1.operand; u->c = d2.operand; u->n = 3; end = 1;
+		}
+		else if (fuse && d.op == 0x1 && d1.op == 0x2 && !inCode(vm, d1.operand)) {
+			u->uop = U_LDA_STA; u->b = d1.operand; u->n = 2;
+		}
+		else if (fuse && d.op == 0x4 && d1.op == 0xA) {
+			u->uop = U_SUB_JN; u->b = d1.operand; u->n = 2; end = 1;
+		}
+		else {
+			switch (d.op) {
+			case 0x1: u->uop = U_LDA; break;
+			case 0x2: u->uop = inCode(vm, d.operand) ? U_STA_CODE : U_STA; end = (u->uop == U_STA_CODE); break;
+			case 0x3: u->uop = U_ADD; break;
+			case 0x4: u->uop = U_SUB; break;
+			case 0x7: u->uop = U_MUL; break;
+			case 0x5: u->uop = U_JMP; end = 1; break;
+			case 0x9: u->uop = U_JZ;  end = 1; break;
+			case 0xA: u->uop = U_JN;  end = 1; break;
+			case 0x8:
+				if (d.operand == 0x002) { u->uop = U_IAC; break; }
+				// HLT, RET, PUSH, POP and invalid ops end the block
+				// fall through
+			default:
+				u->uop = U_CALL; u->b = d.op; u->c = p;
+				end = !(d.op == 0xB || d.op == 0xC || d.op == 0xD);
+				break;
+			}
+		}
+		p += 2*u->n;
+	}
+	b->next = p;
+	vm->block_at[entry] = b;
+	return b;
+}
+
+// Run one block, leaves pc at the next block entry
+static int execBlock(AccComVM *vm, Block *b) {
+	MicroOp *u = b->op, *end = b->op + b->len;
+
+	for (; u < end; u++) {
+		vm->inst_count += u->n;
+		switch (u->uop) {
+		case U_LDA: vm->acc = loadNum(vm, u->a); PSW_ACC(vm); break;
+		case U_STA: writeWord(vm, u->a, cint2accnum(vm->acc)); break;
+		case U_ADD: vm->acc += loadNum(vm, u->a); PSW_ACC(vm); break;
+		case U_SUB: vm->acc -= loadNum(vm, u->a); PSW_ACC(vm); break;
+		case U_MUL: vm->acc *= loadNum(vm, u->a); PSW_ACC(vm); break;
+		case U_IAC: vm->acc += 1; PSW_ACC(vm); break;
+		case U_STA_CODE:
+			writeWord(vm, u->a, cint2accnum(vm->acc));
+			vm->pc = b->next;
+			invalidateCode(vm, u->a);		// b is gone after this
+			return RUN_CONTINUE;
+		case U_JMP:
+			vm->pc = u->a;
+			return RUN_CONTINUE;
+		case U_JZ:
+			vm->pc = (vm->acc == 0) ? u->a : b->next;
+			return RUN_CONTINUE;
+		case U_JN:
+			vm->pc = (vm->acc < 0) ? u->a : b->next;
+			return RUN_CONTINUE;
+		case U_LDA_STA:
+			vm->acc = loadNum(vm, u->a); PSW_ACC(vm);
+			writeWord(vm, u->b, cint2accnum(vm->acc));
+			break;
+		case U_LDA_IAC_STA:
+			vm->acc = loadNum(vm, u->a) + 1; PSW_ACC(vm);
+			writeWord(vm, u->b, cint2accnum(vm->acc));
+			break;
+		case U_LDA_SUB_JN:
+			vm->acc = loadNum(vm, u->a) - loadNum(vm, u->b); PSW_ACC(vm);
+			vm->pc = (vm->acc < 0) ? u->c : b->next;
+			return RUN_CONTINUE;
+		case U_LDA_SUB_JZ:
+			vm->acc = loadNum(vm, u->a) - loadNum(vm, u->b); PSW_ACC(vm);
+			vm->pc = (vm->acc == 0) ? u->c : b->next;
+			return RUN_CONTINUE;
+		case U_SUB_JN:
+			vm->acc -= loadNum(vm, u->a); PSW_ACC(vm);
+			vm->pc = (vm->acc < 0) ? u->b : b->next;
+			return RUN_CONTINUE;
+		case U_CALL:
+			vm->pc = u->c;					// handlers advance pc themselves
+			if (op_table[u->b](vm, u->a) != RUN_CONTINUE) return RUN_EXIT;
+			if (vm->pc != u->c + 2) return RUN_CONTINUE;	// CALL, RET
+			break;
+		}
+	}
+	vm->pc = b->next;
+	return RUN_CONTINUE;
+}
+
+// Run the block at pc, or one instruction outside CODE section
+static int stepBlock(AccComVM *vm) {
+	Block *b;
+
+	if (vm->pc < vm->code_bgn || vm->pc >= vm->code_end) return stepTable(vm);
+	b = vm->block_at[vm->pc];
+	if (b == NULL) b = compileBlock(vm, vm->pc);
+	return execBlock(vm, b);
+}
+
+int runBlock(AccComVM *vm, UINT addr) {
+	vm->pc = addr;
+	if (vm->pc == vm->code_end || stepFirst(vm) != RUN_CONTINUE) return 0;
+	while (vm->pc != vm->code_end) {
+		if (stepBlock(vm) != RUN_CONTINUE) break;
+	}
+	return 0;
+}
+
+//========================================
+// ENGINE_JIT
+// - each basic block is translated to x86-64 code in an mmap'd buffer
+// - translated code is called as fn(vm): r13 = vm, ACC lives in ebx,
+//   mem[] base in r12; PSW is tested from ebx and written back with
+//   ACC, pc and inst_count when the block exits
+// - PRT/PRC/PRS call back into prt()/prc()/prs()
+// - HLT, invalid ops and pc outside CODE run through stepTable()
+//========================================
+#ifdef JIT_X86_64
+#define JIT_BLOCK_MAX	64			// max instructions per block
+#define JIT_INST_MAX	160			// max code bytes per instruction
+
+#define VM_FIELD(f)		((UINT)offsetof(AccComVM, f))
+
+static void emit(AccComVM *vm, int n, ...) {
+	va_list ap;
+	int i;
+
+	va_start(ap, n);
+	for (i = 0; i < n; i++) vm->jit_buf[vm->jit_pos++] = (UCHAR)va_arg(ap, int);
+	va_end(ap);
+}
+
+static void emit32(AccComVM *vm, UINT v) {
+	memcpy(vm->jit_buf + vm->jit_pos, &v, 4);
+	vm->jit_pos += 4;
+}
+
+// movabs rax, p
+static void emitRaxPtr(AccComVM *vm, void *p) {
+	unsigned long long v = (unsigned long long)p;
+	emit(vm, 2, 0x48, 0xB8);
+	memcpy(vm->jit_buf + vm->jit_pos, &v, 8);
+	vm->jit_pos += 8;
+}
+
+// ecx = accnum2cint(readWord(addr))
+static void emitLoad(AccComVM *vm, UINT addr) {
+#ifdef WORD_MEMORY
+	emit(vm, 4, 0x41, 0x0F, 0xBF, 0x8D); emit32(vm, VM_FIELD(num) + 2*addr);	// movsx ecx, word [r13+num+2*addr]
+	return;
+#endif
+	emit(vm, 5, 0x41, 0x0F, 0xB7, 0x84, 0x24); emit32(vm, addr);	// movzx eax, word [r12+addr]
+	emit(vm, 4, 0x66, 0xC1, 0xC8, 0x08);							// ror ax, 8
+	emit(vm, 2, 0x89, 0xC1);										// mov ecx, eax
+	emit(vm, 2, 0x81, 0xE1); emit32(vm, 0x7FFF);					// and ecx, 0x7FFF
+	emit(vm, 2, 0x89, 0xCA);										// mov edx, ecx
+	emit(vm, 2, 0xF7, 0xDA);										// neg edx
+	emit(vm, 1, 0xA9); emit32(vm, 0x8000);							// test eax, 0x8000
+	emit(vm, 3, 0x0F, 0x45, 0xCA);									// cmovne ecx, edx
+}
+
+static void emitCall(AccComVM *vm, void *fn, UINT arg);
+
+// writeWord(addr, cint2accnum(ebx))
+static void emitStore(AccComVM *vm, UINT addr) {
+	emit(vm, 2, 0x89, 0xD8);										// mov eax, ebx
+	emit(vm, 2, 0xF7, 0xD8);										// neg eax
+	emit(vm, 3, 0x0F, 0x48, 0xC3);									// cmovs eax, ebx
+	emit(vm, 1, 0x25); emit32(vm, 0x7FFF);							// and eax, 0x7FFF
+	emit(vm, 2, 0x89, 0xDA);										// mov edx, ebx
+	emit(vm, 3, 0xC1, 0xEA, 0x10);									// shr edx, 16
+	emit(vm, 2, 0x81, 0xE2); emit32(vm, 0x8000);					// and edx, 0x8000
+	emit(vm, 2, 0x09, 0xD0);										// or eax, edx
+	emit(vm, 4, 0x66, 0xC1, 0xC8, 0x08);							// ror ax, 8
+	emit(vm, 5, 0x66, 0x41, 0x89, 0x84, 0x24); emit32(vm, addr);	// mov [r12+addr], ax
+	emit(vm, 3, 0x41, 0xC6, 0x85); emit32(vm, VM_FIELD(dirty) + (addr >> SNAP_SHIFT)); emit(vm, 1, 1);	// mov byte [r13+dirty], 1
+	if (((addr + 1) >> SNAP_SHIFT) != (addr >> SNAP_SHIFT)) {
+		emit(vm, 3, 0x41, 0xC6, 0x85); emit32(vm, VM_FIELD(dirty) + ((addr + 1) >> SNAP_SHIFT)); emit(vm, 1, 1);
+	}
+#ifdef WORD_MEMORY
+	emitCall(vm, (void *)numUpdate, addr);
+#endif
+}
+
+// fn(vm, arg)
+static void emitCall(AccComVM *vm, void *fn, UINT arg) {
+	emit(vm, 3, 0x4C, 0x89, 0xEF);									// mov rdi, r13
+	emit(vm, 1, 0xBE); emit32(vm, arg);								// mov esi, arg
+	emitRaxPtr(vm, fn);
+	emit(vm, 2, 0xFF, 0xD0);										// call rax
+}
+
+// Write back state and return with pc = next, n instructions executed
+static void emitExit(AccComVM *vm, UINT next, UINT n) {
+	emit(vm, 3, 0x41, 0x89, 0x9D); emit32(vm, VM_FIELD(acc));		// mov [r13+acc], ebx
+#ifdef PSW_EAGER
+	emit(vm, 4, 0x31, 0xC9, 0x85, 0xDB);							// xor ecx, ecx; test ebx, ebx
+	emit(vm, 3, 0x0F, 0x94, 0xC1);									// sete cl
+	emit(vm, 3, 0x41, 0x89, 0x8D); emit32(vm, VM_FIELD(psw_zerobit));	// mov [r13+psw_zerobit], ecx
+	emit(vm, 4, 0x31, 0xC9, 0x85, 0xDB);
+	emit(vm, 3, 0x0F, 0x98, 0xC1);									// sets cl
+	emit(vm, 3, 0x41, 0x89, 0x8D); emit32(vm, VM_FIELD(psw_signbit));	// mov [r13+psw_signbit], ecx
+#endif
+	emit(vm, 3, 0x41, 0xC7, 0x85); emit32(vm, VM_FIELD(pc)); emit32(vm, next);		// mov dword [r13+pc], next
+	emit(vm, 3, 0x49, 0x81, 0x85); emit32(vm, VM_FIELD(inst_count)); emit32(vm, n);	// add qword [r13+inst_count], n
+	emit(vm, 6, 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3);				// pop r13; pop r12; pop rbx; ret
+}
+
+// Conditional exit: jcc (ebx) to target, else fall out to next
+static void emitBranch(AccComVM *vm, int jcc_not, UINT target, UINT next, UINT n) {
+	UINT patch, rel;
+
+	emit(vm, 2, 0x85, 0xDB);										// test ebx, ebx
+	emit(vm, 2, 0x0F, jcc_not); patch = vm->jit_pos; emit32(vm, 0);	// jnz/jns not_taken
+	emitExit(vm, target, n);
+	rel = vm->jit_pos - (patch + 4);
+	memcpy(vm->jit_buf + patch, &rel, 4);
+	emitExit(vm, next, n);
+}
+
+// Instructions handled by the JIT (HLT and invalid ops are not)
+static int jitable(DecodedInst d) {
+#ifdef MEM_CHECK
+	if (!memOk(d) || d.op == 0xD) return 0;		// traps need the exact vm->pc
+#endif
+	switch (d.op) {
+	case 0x1: case 0x2: case 0x3: case 0x4: case 0x5: case 0x7:
+	case 0x9: case 0xA: case 0xB: case 0xC: case 0xD:
+		return 1;
+	case 0x8:
+		return d.operand == 0x002;
+	}
+	return 0;
+}
+
+void jitFlush(AccComVM *vm) {
+	memset(vm->jit_at, 0, sizeof(vm->jit_at));
+	vm->jit_pos = 0;
+}
+
+// Translate the block starting at entry (entry must be jitable)
+JitFn jitCompile(AccComVM *vm, UINT entry) {
+	JitFn fn;
+	DecodedInst d;
+	UINT p = entry;
+	UINT n = 0;			// # of translated instructions
+
+	if (vm->jit_pos + JIT_BLOCK_MAX*JIT_INST_MAX > JIT_SIZE) jitFlush(vm);
+	fn = (JitFn)(void *)(vm->jit_buf + vm->jit_pos);
+
+	emit(vm, 5, 0x53, 0x41, 0x54, 0x41, 0x55);						// push rbx; push r12; push r13
+	emit(vm, 3, 0x49, 0x89, 0xFD);									// mov r13, rdi
+	emit(vm, 3, 0x41, 0x8B, 0x9D); emit32(vm, VM_FIELD(acc));		// mov ebx, [r13+acc]
+	emit(vm, 3, 0x4C, 0x8D, 0xA7); emit32(vm, VM_FIELD(mem));		// lea r12, [rdi+mem]
+
+	for (;;) {
+		if (p >= vm->code_end || n == JIT_BLOCK_MAX || !jitable(vm->decoded[p])) {
+			emitExit(vm, p, n);
+			break;
+		}
+		d = vm->decoded[p];
+		n++;
+		switch (d.op) {
+		case 0x1: emitLoad(vm, d.operand); emit(vm, 2, 0x89, 0xCB); break;			// mov ebx, ecx
+		case 0x3: emitLoad(vm, d.operand); emit(vm, 2, 0x01, 0xCB); break;			// add ebx, ecx
+		case 0x4: emitLoad(vm, d.operand); emit(vm, 2, 0x29, 0xCB); break;			// sub ebx, ecx
+		case 0x7: emitLoad(vm, d.operand); emit(vm, 3, 0x0F, 0xAF, 0xD9); break;	// imul ebx, ecx
+		case 0x8: emit(vm, 3, 0x83, 0xC3, 0x01); break;								// add ebx, 1
+		case 0xB: emitCall(vm, (void *)prt, d.operand); break;
+		case 0xC: emitCall(vm, (void *)prc, d.operand); break;
+		case 0xD: emitCall(vm, (void *)prs, d.operand); break;
+		case 0x2:
+			emitStore(vm, d.operand);
+			if (d.operand + 1 >= vm->code_bgn && d.operand < vm->code_end) {
+				// self-modifying store: re-decode and leave the block
+				emitCall(vm, (void *)invalidateCode, d.operand);
+				emitExit(vm, p + 2, n);
+				goto done;
+			}
+			break;
+		case 0x5: emitExit(vm, d.operand, n); goto done;
+		case 0x9: emitBranch(vm, 0x85, d.operand, p + 2, n); goto done;		// jnz
+		case 0xA: emitBranch(vm, 0x89, d.operand, p + 2, n); goto done;		// jns
+		}
+		p += 2;
+	}
+done:
+	vm->jit_at[entry] = fn;
+	return fn;
+}
+
+static int jitInit(AccComVM *vm) {
+	if (vm->jit_buf != NULL || vm->jit_failed) return !vm->jit_failed;
+	vm->jit_buf = mmap(NULL, JIT_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (vm->jit_buf == MAP_FAILED) {
+		fprintf(stderr, "jit: mmap failed, using block engine\n");
+		vm->jit_buf = NULL;
+		vm->jit_failed = 1;
+	}
+	return !vm->jit_failed;
+}
+
+// Run the translated block at pc, or one instruction through stepTable()
+static int stepJit(AccComVM *vm) {
+	JitFn fn;
+
+	if (vm->jit_failed) return stepBlock(vm);
+	if (vm->pc < vm->code_bgn || vm->pc >= vm->code_end || !jitable(vm->decoded[vm->pc]))
+		return stepTable(vm);
+	fn = vm->jit_at[vm->pc];
+	if (fn == NULL) fn = jitCompile(vm, vm->pc);
+	fn(vm);
+	return RUN_CONTINUE;
+}
+
+int runJit(AccComVM *vm, UINT addr) {
+	jitInit(vm);
+	vm->pc = addr;
+	if (vm->pc == vm->code_end || stepFirst(vm) != RUN_CONTINUE) return 0;
+	while (vm->pc != vm->code_end) {
+		if (stepJit(vm) != RUN_CONTINUE) break;
+	}
+	return 0;
+}
+#else
+void jitFlush(AccComVM *vm) {
+}
+
+static int stepJit(AccComVM *vm) {
+	return stepBlock(vm);
+}
+
+int runJit(AccComVM *vm, UINT addr) {
+	return runBlock(vm, addr);
+}
+#endif
+
+//========================================
+// Counted loops
+// - CFG of the CODE section reachable from the run entry, dominators
+//   (Cooper, Harvey, Kennedy), natural loops of the back edges
+// - a loop qualifies if one iteration is a single path of LDA, STA,
+//   ADD, SUB, MUL, IAC, PRC and JMP with one JZ/JN leaving the loop and
+//   one STA, the induction variable; all other reads are invariant
+// - on entry the trip count is solved from memory: the counter is
+//   written once, PRC output goes out in bulk and ACC, PSW and
+//   inst_count end as if every iteration had run; without a proof
+//   (no finite trip count, values out of range) the loop runs normally
+//========================================
+void cfgAlloc(Cfg *g, AccComVM *vm) {
+	memset(g, 0, sizeof(Cfg));
+	g->vm = vm;
+	g->seen = calloc(MEM_ALLOC, 1);
+	g->leader = calloc(MEM_ALLOC, 1);
+	g->block_of = malloc(MEM_ALLOC*sizeof(int));
+	g->b = malloc(MEM_SIZE*sizeof(CfgBlock));
+	g->pred = malloc(2*MEM_SIZE*sizeof(int));
+	g->pred_at = malloc((MEM_SIZE + 1)*sizeof(int));
+	g->body = malloc(MEM_SIZE);
+	if (g->seen == NULL || g->leader == NULL || g->block_of == NULL || g->b == NULL ||
+		g->pred == NULL || g->pred_at == NULL || g->body == NULL) {
+		printf("Error: out of memory");
+		exit(-1);
+	}
+}
+
+void cfgFree(Cfg *g) {
+	free(g->seen);
+	free(g->leader);
+	free(g->block_of);
+	free(g->b);
+	free(g->pred);
+	free(g->pred_at);
+	free(g->body);
+}
+
+// Last instruction of a block: jumps, CALL, HLT, RET and invalid ops
+static int endsBlock(DecodedInst d) {
+	switch (d.op) {
+	case 0x1: case 0x2: case 0x3: case 0x4: case 0x7:
+	case 0xB: case 0xC: case 0xD:
+		return 0;
+	case 0x8:
+		return !(d.operand == 0x002 || d.operand == 0x003 || d.operand == 0x004);
+	default:
+		return 1;
+	}
+}
+
+// Successor pcs of the instruction at pc inside CODE section, return #
+static int instSucc(AccComVM *vm, UINT pc, UINT next[2]) {
+	DecodedInst d = vm->decoded[pc];
+	int n = 0, i, k;
+
+	switch (d.op) {
+	case 0x5:									// JMP
+		next[n++] = d.operand;
+		break;
+	case 0x6: case 0x9: case 0xA:				// CALL returns to pc + 2
+		next[n++] = d.operand;
+		next[n++] = pc + 2;
+		break;
+	case 0x0: case 0xE: case 0xF:				// invalid
+		break;
+	default:									// HLT, RET: none
+		if (!endsBlock(d)) next[n++] = pc + 2;
+		break;
+	}
+	for (i = k = 0; i < n; i++)
+		if (codeAt(vm, next[i])) next[k++] = next[i];
+	return k;
+}
+
+// Find blocks reachable from root, return root block or -1
+int cfgBuild(Cfg *g, UINT root) {
+	AccComVM *vm = g->vm;
+	int *stack = g->block_of;		// reused as work stack before blocks exist
+	UINT next[2], p;
+	int sp = 0, i, n, k;
+
+	if (!codeAt(vm, root)) return -1;
+	g->seen[root] = g->leader[root] = 1;
+	stack[sp++] = (int)root;
+	while (sp > 0) {
+		p = (UINT)stack[--sp];
+		n = instSucc(vm, p, next);
+		for (i = 0; i < n; i++) {
+			if (endsBlock(vm->decoded[p])) g->leader[next[i]] = 1;
+			if (!g->seen[next[i]]) {
+				g->seen[next[i]] = 1;
+				stack[sp++] = (int)next[i];
+			}
+		}
+	}
+
+	for (p = 0; p < MEM_SIZE; p++) g->block_of[p] = -1;
+	g->nb = 0;
+	for (p = vm->code_bgn; p < vm->code_end; p++) {
+		if (!g->seen[p] || !g->leader[p]) continue;
+		g->b[g->nb].bgn = p;
+		while (!endsBlock(vm->decoded[p]) && codeAt(vm, p + 2) && !g->leader[p + 2]) {
+			g->block_of[p] = g->nb;
+			p += 2;
+		}
+		g->block_of[p] = g->nb;
+		g->b[g->nb].last = p;
+		p = g->b[g->nb++].bgn;
+	}
+	for (i = 0; i < g->nb; i++) {
+		n = instSucc(vm, g->b[i].last, next);
+		g->b[i].succ[0] = g->b[i].succ[1] = -1;
+		for (k = 0; k < n; k++) g->b[i].succ[k] = g->block_of[next[k]];
+		g->b[i].idom = -1;
+	}
+
+	// predecessor lists
+	for (i = 0; i <= g->nb; i++) g->pred_at[i] = 0;
+	for (i = 0; i < g->nb; i++)
+		for (k = 0; k < 2; k++)
+			if (g->b[i].succ[k] >= 0) g->pred_at[g->b[i].succ[k] + 1]++;
+	for (i = 0; i < g->nb; i++) g->pred_at[i + 1] += g->pred_at[i];
+	for (i = 0; i < g->nb; i++)
+		for (k = 0; k < 2; k++)
+			if (g->b[i].succ[k] >= 0) g->pred[g->pred_at[g->b[i].succ[k]]++] = i;
+	for (i = g->nb; i > 0; i--) g->pred_at[i] = g->pred_at[i - 1];
+	g->pred_at[0] = 0;
+	return g->block_of[root];
+}
+
+// Immediate dominators of the blocks reachable from root
+static void cfgDominators(Cfg *g, int root) {
+	int *order = malloc((g->nb + 1)*sizeof(int));		// blocks in reverse postorder
+	int *stack = malloc((g->nb + 1)*sizeof(int));
+	UCHAR *state = calloc(g->nb + 1, 1);				// 1: on stack, 2: done
+	int sp = 0, n = 0, b, s, k, i, x, y, idom, changed;
+
+	if (order == NULL || stack == NULL || state == NULL) {
+		printf("Error: out of memory");
+		exit(-1);
+	}
+	stack[sp++] = root;
+	state[root] = 1;
+	while (sp > 0) {			// iterative DFS, a block is done after its successors
+		b = stack[sp - 1];
+		for (k = 0; k < 2; k++) {
+			s = g->b[b].succ[k];
+			if (s >= 0 && state[s] == 0) {
+				state[s] = 1;
+				stack[sp++] = s;
+				break;
+			}
+		}
+		if (k == 2) {
+			state[b] = 2;
+			order[n++] = b;
+			sp--;
+		}
+	}
+	for (i = 0; i < n; i++) g->b[order[i]].rpo = n - 1 - i;
+	g->b[root].idom = root;
+	do {
+		changed = 0;
+		for (i = n - 2; i >= 0; i--) {		// reverse postorder, root excluded
+			b = order[i];
+			idom = -1;
+			for (k = g->pred_at[b]; k < g->pred_at[b + 1]; k++) {
+				x = g->pred[k];
+				if (g->b[x].idom < 0) continue;
+				if (idom < 0) { idom = x; continue; }
+				y = idom;
+				while (x != y) {
+					while (g->b[x].rpo > g->b[y].rpo) x = g->b[x].idom;
+					while (g->b[y].rpo > g->b[x].rpo) y = g->b[y].idom;
+				}
+				idom = x;
+			}
+			if (g->b[b].idom != idom) {
+				g->b[b].idom = idom;
+				changed = 1;
+			}
+		}
+	} while (changed);
+	free(order);
+	free(stack);
+	free(state);
+}
+
+// Does block d dominate block b
+static int cfgDominates(Cfg *g, int d, int b) {
+	while (b != d && g->b[b].idom != b) b = g->b[b].idom;
+	return b == d;
+}
+
+// Mark the natural loop of back edge tail -> head in g->body
+static void cfgLoopBody(Cfg *g, int head, int tail) {
+	int *stack = malloc((g->nb + 1)*sizeof(int));
+	int sp = 0, b, k, x;
+
+	if (stack == NULL) {
+		printf("Error: out of memory");
+		exit(-1);
+	}
+	memset(g->body, 0, g->nb);
+	g->body[head] = 1;
+	if (!g->body[tail]) { g->body[tail] = 1; stack[sp++] = tail; }
+	while (sp > 0) {
+		b = stack[--sp];
+		for (k = g->pred_at[b]; k < g->pred_at[b + 1]; k++) {
+			x = g->pred[k];
+			if (g->b[x].idom >= 0 && !g->body[x]) { g->body[x] = 1; stack[sp++] = x; }
+		}
+	}
+	free(stack);
+}
+
+// Is pc an instruction of the loop in g->body
+static int inBody(Cfg *g, UINT pc) {
+	return codeAt(g->vm, pc) && g->block_of[pc] >= 0 && g->body[g->block_of[pc]];
+}
+
+// Does a read of the word at a overlap the induction variable at iv
+static int overlaps(UINT a, UINT iv) {
+	return a != iv && a + 1 >= iv && a <= iv + 1;
+}
+
+// Walk one iteration of the loop in g->body from head into l, return 0
+// if it is not a counted loop
+static int loopShape(Cfg *g, UINT head, Loop *l) {
+	AccComVM *vm = g->vm;
+	DecodedInst d;
+	UINT p = head, next;
+	int i, acc_set = 0, in_target, in_next;
+
+	memset(l, 0, sizeof(Loop));
+	l->head = head;
+	l->branch = l->store = -1;
+	for (;;) {
+		if (l->len == LOOP_LEN) return 0;
+		d = vm->decoded[p];
+		l->inst[l->len++] = d;
+		next = p + 2;
+		switch (d.op) {
+		case 0x1:						// LDA
+			acc_set = 1;
+			if (d.operand + 1 >= MEM_SIZE) return 0;
+			break;
+		case 0x3: case 0x4: case 0x7:	// ADD, SUB, MUL
+			if (!acc_set || d.operand + 1 >= MEM_SIZE) return 0;
+			break;
+		case 0x2:						// STA
+			if (!acc_set || l->store >= 0 || d.operand + 1 >= MEM_SIZE || inCode(vm, d.operand)) return 0;
+			l->store = l->len - 1;
+			l->iv = d.operand;
+			break;
+		case 0x8:						// IAC
+			if (!acc_set || d.operand != 0x002) return 0;
+			break;
+		case 0xC:						// PRC
+			l->out[l->nout++] = (char)d.operand;
+			break;
+		case 0x5:						// JMP
+			next = d.operand;
+			break;
+		case 0x9: case 0xA:				// JZ, JN
+			in_target = inBody(g, d.operand);
+			in_next = inBody(g, p + 2);
+			if (!acc_set || l->branch >= 0 || in_target == in_next) return 0;
+			l->branch = l->len - 1;
+			l->nout_pre = l->nout;
+			if (in_target) {			// taken stays: must be the back edge
+				if (d.operand != head) return 0;
+				l->latch = 1;
+				l->exit_pc = p + 2;
+				next = head;
+			}
+			else l->exit_pc = d.operand;
+			break;
+		default:
+			return 0;
+		}
+		if (next == head) break;
+		if (!inBody(g, next)) return 0;
+		p = next;
+	}
+	if (l->branch < 0 || l->store < 0) return 0;
+	for (i = 0; i < l->len; i++) {
+		d = l->inst[i];
+		if ((d.op == 0x1 || d.op == 0x3 || d.op == 0x4 || d.op == 0x7) && overlaps(d.operand, l->iv)) return 0;
+	}
+	return 1;
+}
+
+// Analyze the counted loops reachable from root
+void loopAnalyze(AccComVM *vm, UINT root) {
+	Cfg g;
+	Loop l;
+	int r, i, k, h, cap = 0;
+
+	memset(vm->loop_at, 0, sizeof(vm->loop_at));
+	vm->loop_count = 0;
+	vm->loop_root = root;
+	vm->loop_valid = 1;
+
+	cfgAlloc(&g, vm);
+	if ((r = cfgBuild(&g, root)) >= 0) {
+		cfgDominators(&g, r);
+		for (i = 0; i < g.nb; i++) {
+			if (g.b[i].idom < 0) continue;
+			for (k = 0; k < 2; k++) {
+				h = g.b[i].succ[k];
+				if (h < 0 || !cfgDominates(&g, h, i) || vm->loop_at[g.b[h].bgn] != 0) continue;
+				cfgLoopBody(&g, h, i);
+				if (!loopShape(&g, g.b[h].bgn, &l)) continue;
+				if (vm->loop_count == cap) {
+					cap = cap ? 2*cap : 16;
+					vm->loop_pool = realloc(vm->loop_pool, cap*sizeof(Loop));
+					if (vm->loop_pool == NULL) {
+						printf("Error: out of memory");
+						exit(-1);
+					}
+				}
+				vm->loop_pool[vm->loop_count++] = l;
+				vm->loop_at[l.head] = (unsigned short)vm->loop_count;
+			}
+		}
+	}
+	cfgFree(&g);
+}
+
+// Analyze loops for a run from root unless done
+static void loopPrepare(AccComVM *vm, UINT root) {
+	if (!vm->loop_valid || vm->loop_root != root) loopAnalyze(vm, root);
+}
+
+// Affine value a*v + b of the induction variable v
+typedef struct {
+	long long a, b;
+} Affine;
+
+#define LOOP_INT_MAX	0x7FFFFFFFLL	// ACC stays a C int
+#define LOOP_NUM_MAX	0x7FFFLL		// stored counter stays an AccCom number
+
+static long long affineAt(Affine e, long long v) {
+	return e.a*v + e.b;
+}
+
+// Run loop l from its header in one step if its trip count is proven
+// and it ends within max instructions, return 1 if it ran
+static int loopRun(AccComVM *vm, const Loop *l, unsigned long long max) {
+	Affine acc = { 0, 0 }, iv = { 1, 0 }, x = { 0, 0 }, val[LOOP_LEN];
+	DecodedInst d;
+	long long v0, step, A, B, m, last, v, n;
+	int i;
+
+	// one iteration symbolically, invariants read from memory
+	for (i = 0; i < l->len; i++) {
+		d = l->inst[i];
+		if (d.op == 0x1 || d.op == 0x3 || d.op == 0x4 || d.op == 0x7) {
+			if (d.operand == l->iv) x = iv;
+			else { x.a = 0; x.b = loadNum(vm, d.operand); }
+		}
+		switch (d.op) {
+		case 0x1: acc = x; break;
+		case 0x3: acc.a += x.a; acc.b += x.b; break;
+		case 0x4: acc.a -= x.a; acc.b -= x.b; break;
+		case 0x7:
+			if (acc.a != 0 && x.a != 0) return 0;		// v*v
+			acc.a = acc.a*x.b + acc.b*x.a;
+			acc.b *= x.b;
+			break;
+		case 0x8: acc.b++; break;
+		case 0x2: iv = acc; break;
+		}
+		if (acc.a > LOOP_INT_MAX || acc.a < -LOOP_INT_MAX || acc.b > LOOP_INT_MAX || acc.b < -LOOP_INT_MAX) return 0;
+		val[i] = acc;
+	}
+	if (iv.a != 1) return 0;		// counter must step by a constant
+	step = iv.b;
+
+	// trip count m: iterations 0 ~ m - 1 run whole, m leaves at the branch
+	v0 = loadNum(vm, l->iv);
+	A = val[l->branch].a*step;
+	B = affineAt(val[l->branch], v0);
+	if (l->inst[l->branch].op == 0xA) {
+		if (!l->latch) {			// leave when < 0
+			if (B < 0) m = 0;
+			else if (A >= 0) return 0;
+			else m = B/(-A) + 1;
+		}
+		else {						// stay while < 0
+			if (B >= 0) m = 0;
+			else if (A <= 0) return 0;
+			else m = (-B + A - 1)/A;
+		}
+	}
+	else {
+		if (!l->latch) {			// leave when == 0
+			if (B == 0) m = 0;
+			else if (A == 0 || (-B)%A != 0 || (-B)/A < 0) return 0;
+			else m = (-B)/A;
+		}
+		else {						// stay while == 0
+			if (B != 0) m = 0;
+			else if (A == 0) return 0;
+			else m = 1;
+		}
+	}
+	if (m > LOOP_NUM_MAX*2 + 1) return 0;
+	n = m*l->len + l->branch + 1;
+	if ((unsigned long long)n > max) return 0;
+
+	// values are affine in the iteration, so both ends bound them
+	for (i = 0; i < l->len; i++) {
+		last = (i <= l->branch) ? m : m - 1;
+		if (last < 0) continue;
+		v = affineAt(val[i], v0);
+		if (v > LOOP_INT_MAX || v < -LOOP_INT_MAX) return 0;
+		v = affineAt(val[i], v0 + last*step);
+		if (v > LOOP_INT_MAX || v < -LOOP_INT_MAX) return 0;
+		if (i == l->store && (affineAt(val[i], v0) > LOOP_NUM_MAX || affineAt(val[i], v0) < -LOOP_NUM_MAX ||
+			v > LOOP_NUM_MAX || v < -LOOP_NUM_MAX)) return 0;
+	}
+
+	// commit
+	last = (l->store < l->branch) ? m + 1 : m;		// # of counter writes
+	if (last > 0) writeWord(vm, l->iv, cint2accnum((int)(v0 + last*step)));
+	sinkRepeat(&vm->out, l->out, l->nout, m);
+	sinkWrite(&vm->out, l->out, l->nout_pre);
+	vm->acc = (int)affineAt(val[l->branch], v0 + m*step);
+	PSW_ACC(vm);
+	vm->pc = l->exit_pc;
+	vm->inst_count += n;
+	return 1;
+}
+
+// Run the loop at pc in one step, return 1 if it ran
+// - max: instruction limit of the step
+static int loopStep(AccComVM *vm, unsigned long long max) {
+	UINT i;
+
+	if (vm->code_dirty || vm->pc >= MEM_SIZE || (i = vm->loop_at[vm->pc]) == 0) return 0;
+	return loopRun(vm, &vm->loop_pool[i - 1], max);
+}
+
+//========================================
+// Run program
+// - addr: start address of program
+// - return exit state = 0: normal exit
+//                       1: error exit
+//                       2: instruction budget used up (EXIT_BUDGET)
+//                       3: wall-clock limit reached (EXIT_TIMEOUT)
+//========================================
+// Run one engine step (one block for block/jit engines)
+static int stepEngine(AccComVM *vm) {
+	switch (vm->engine) {
+	case ENGINE_BLOCK:	return stepBlock(vm);
+	case ENGINE_JIT:	return stepJit(vm);
+	default:			return stepTable(vm);
+	}
+}
+
+// Run with checkpoints and watchdog
+// - a full checkpoint record is written before the first instruction,
+//   then one every vm->ckpt_every instructions
+// - counts are checked between steps of stepEngine(), so records and
+//   stops fall on block boundaries; threaded runs step through op_table
+// - with vm->accel a counted loop is one step if it fits in the budget
+int runGuarded(AccComVM *vm, UINT addr) {
+	unsigned long long ckpt = ~0ULL, next;
+	Watchdog w;
+	int exit_code;
+
+#ifdef JIT_X86_64
+	if (vm->engine == ENGINE_JIT) jitInit(vm);
+#endif
+	if (vm->accel) loopPrepare(vm, addr);
+	vm->pc = addr;
+	watchStart(vm, &w);
+	if (vm->ckpt != NULL) {
+		if (snapshotWrite(vm, vm->ckpt, 1) != 0) fprintf(stderr, "Error: checkpoint write failed\n");
+		ckpt = vm->inst_count + vm->ckpt_every;
+	}
+	watchTail(vm);
+	if (vm->pc == vm->code_end || stepFirst(vm) != RUN_CONTINUE) return 0;
+	next = (ckpt < watchNext(&w)) ? ckpt : watchNext(&w);
+	while (vm->pc != vm->code_end) {
+		watchTail(vm);
+		if (!(vm->accel && loopStep(vm, w.end - vm->inst_count)) && stepEngine(vm) != RUN_CONTINUE) break;
+		if (vm->inst_count < next) continue;
+		if (vm->inst_count >= ckpt) {
+			if (snapshotWrite(vm, vm->ckpt, 0) != 0) fprintf(stderr, "Error: checkpoint write failed\n");
+			ckpt = vm->inst_count + vm->ckpt_every;
+		}
+		if ((exit_code = watchCheck(vm, &w)) != 0) return exit_code;
+		next = (ckpt < watchNext(&w)) ? ckpt : watchNext(&w);
+	}
+	return 0;
+}
+
+// Run with counted loops in one step (-accel)
+// - between loops the engine steps as in runGuarded()
+int runAccel(AccComVM *vm, UINT addr) {
+#ifdef JIT_X86_64
+	if (vm->engine == ENGINE_JIT) jitInit(vm);
+#endif
+	loopPrepare(vm, addr);
+	vm->pc = addr;
+	if (vm->pc == vm->code_end || stepFirst(vm) != RUN_CONTINUE) return 0;
+	while (vm->pc != vm->code_end) {
+		if (loopStep(vm, ~0ULL)) continue;
+		if (stepEngine(vm) != RUN_CONTINUE) break;
+	}
+	return 0;
+}
+
+int runProgram(AccComVM *vm, UINT addr) {
+	int exit_code;
+
+	if (vm->prof != NULL || vm->trace.rec != NULL) exit_code = runInstrumented(vm, addr);
+	else if (vm->ckpt != NULL || vm->budget != 0 || vm->timeout > 0) exit_code = runGuarded(vm, addr);
+	else if (vm->accel) exit_code = runAccel(vm, addr);
+	else switch (vm->engine) {
+	case ENGINE_TABLE:		exit_code = runTable(vm, addr); break;
+	case ENGINE_THREADED:	exit_code = runThreaded(vm, addr); break;
+	case ENGINE_BLOCK:		exit_code = runBlock(vm, addr); break;
+	case ENGINE_JIT:		exit_code = runJit(vm, addr); break;
+	default:				exit_code = runSwitch(vm, addr); break;
+	}
+	pswSync(vm);
+	sinkFlush(&vm->out);
+	return exit_code;
+}
+
+//========================================
+// Differential test
+// - random programs run on an ENGINE_SWITCH machine and on a machine
+//   with the selected engine in lockstep: the engine runs one block,
+//   the reference runs the same # of instructions, then both machines
+//   are compared
+// - with -accel a counted loop is one step of the engine
+//========================================
+typedef struct {
+	AccComVM *vm;		// output goes to a memory sink
+	int halted;
+} DiffMachine;
+
+static int diffSame(DiffMachine *a, DiffMachine *b) {
+	AccComVM *x = a->vm, *y = b->vm;
+
+	sinkFlush(&x->out);
+	sinkFlush(&y->out);
+	return memcmp(x->mem, y->mem, MEM_ALLOC) == 0 &&
+		x->acc == y->acc && x->pc == y->pc && x->tos == y->tos &&
+		pswZero(x) == pswZero(y) && pswSign(x) == pswSign(y) &&
+		a->halted == b->halted &&
+		x->out.mem_len == y->out.mem_len &&
+		memcmp(x->out.mem, y->out.mem, x->out.mem_len) == 0;
+}
+
+// xorshift32, reproducible by seed
+static UINT diff_rand = 1;
+static UINT diffRand(UINT n) {
+	diff_rand ^= diff_rand << 13;
+	diff_rand ^= diff_rand >> 17;
+	diff_rand ^= diff_rand << 5;
+	return diff_rand % n;
+}
+
+// Generate a random program: 16 DATA words at 0x0100, 1~48 CODE words at 0x0200
+// - one in three programs gets a counter loop somewhere in CODE
+static void diffGenerate(AccComVM *vm) {
+	static const UCHAR ops[] = { 0x1, 0x1, 0x2, 0x2, 0x3, 0x4, 0x4, 0x5, 0x6, 0x7,
+								 0x8, 0x8, 0x8, 0x9, 0xA, 0xA, 0xB, 0xC, 0xD };
+	UINT ncode, i, op, operand, r, h, n, lim, step;
+
+	memset(vm->mem, 0, MEM_ALLOC);
+	vm->data_bgn = 0x0100;
+	vm->data_end = vm->data_bgn + 2*16;
+	for (i = vm->data_bgn; i < vm->data_end; i += 2)
+		writeWord(vm, i, diffRand(4) ? cint2accnum((int)diffRand(41) - 20) : 0x4100 + diffRand(0x3F00));
+
+	ncode = 1 + diffRand(48);
+	vm->code_bgn = 0x0200;
+	vm->code_end = vm->code_bgn + 2*ncode;
+	for (i = vm->code_bgn; i < vm->code_end; i += 2) {
+		op = ops[diffRand(sizeof(ops))];
+		r = diffRand(20);
+		if (op == 0x5 || op == 0x6 || op == 0x9 || op == 0xA)	// jump into CODE, rarely elsewhere
+			operand = r ? vm->code_bgn + 2*diffRand(ncode + 1) : diffRand(0x0400);
+		else if (op == 0x8)							// IAC, RET, PUSH, POP, rarely HLT or invalid
+			operand = r > 7 ? 0x002 : (r > 5 ? 0x001 : (r > 3 ? 0x003 : (r > 1 ? 0x004 : (r ? 0x000 : diffRand(0x1000)))));
+		else if (op == 0xC)
+			operand = 0x20 + diffRand(0x5F);
+		else if (op == 0x2 && r == 0)				// self-modifying STA
+			operand = vm->code_bgn + diffRand(2*ncode);
+		else
+			operand = r ? vm->data_bgn + 2*diffRand(16) : diffRand(0x0FFE);
+		if (diffRand(200) == 0) op = (diffRand(2) ? 0xE : 0xF);	// invalid opcode
+		writeWord(vm, i, (op << 12) | operand);
+	}
+
+	if (ncode >= 8 && diffRand(3) == 0) {
+		h = vm->code_bgn + 2*diffRand(ncode - 7);
+		n = vm->data_bgn + 2*diffRand(16);
+		lim = vm->data_bgn + 2*diffRand(16);
+		step = diffRand(3) ? 0x8002 : 0x3000 | (vm->data_bgn + 2*diffRand(16));	// IAC or ADD
+		if (diffRand(2))		// test first, leave on JN/JZ
+			writeWords(vm, h, 0x1000 | n, 0x4000 | lim, (diffRand(2) ? 0xA000 : 0x9000) | (h + 16),
+				0xC000 | (0x20 + diffRand(0x5F)), 0x1000 | n, step, 0x2000 | n, 0x5000 | h, END_OF_ARG);
+		else					// test last, stay on JN
+			writeWords(vm, h, 0xC000 | (0x20 + diffRand(0x5F)), 0x1000 | n, step, 0x2000 | n,
+				0x1000 | n, 0x4000 | lim, 0xA000 | h, END_OF_ARG);
+	}
+}
+
+// Reset machine registers and copy program of src
+static void diffReset(AccComVM *vm, AccComVM *src) {
+	if (vm != src) {
+		memcpy(vm->mem, src->mem, MEM_ALLOC);
+		vm->data_bgn = src->data_bgn; vm->data_end = src->data_end;
+		vm->code_bgn = src->code_bgn; vm->code_end = src->code_end;
+	}
+	decodeProgram(vm);
+	vm->acc = 0; vm->pc = vm->code_bgn; vm->tos = vm->stack_bgn;
+	vm->psw_zerobit = 0; vm->psw_signbit = 0; vm->psw_lazy = 0;
+	sinkReset(&vm->out);
+}
+
+// Run ref and dut from their reset state in lockstep, compare after
+// every dut step
+// - return # of instructions run by ref, *bad = 1 on mismatch
+static unsigned long long diffRun(DiffMachine *ref, DiffMachine *dut, unsigned long long budget, int *bad) {
+	unsigned long long before, n, k;
+	int first;
+
+	ref->halted = dut->halted = 0;
+	*bad = 0;
+	if (dut->vm->accel) loopPrepare(dut->vm, dut->vm->pc);
+	for (k = 0, first = 1; !ref->halted && ref->vm->pc != ref->vm->code_end && k < budget; first = 0) {
+		before = dut->vm->inst_count;
+		if (!first && dut->vm->accel && loopStep(dut->vm, budget - k)) dut->halted = 0;
+		else dut->halted = ((first ? stepFirst(dut->vm) : stepEngine(dut->vm)) != RUN_CONTINUE);
+		n = dut->vm->inst_count - before;
+
+		for (; n > 0; n--, k++) {
+			if (stepSwitch(ref->vm) != RUN_CONTINUE) { ref->halted = 1; k++; break; }
+		}
+
+		if (!diffSame(ref, dut)) {
+			*bad = 1;
+			break;
+		}
+	}
+	return k;
+}
+
+static void diffReport(FILE *fp, DiffMachine *ref, DiffMachine *dut) {
+	fprintf(fp, "  ref: pc=%04X acc=%d Z=%d N=%d halted=%d out=%lu\n",
+		ref->vm->pc, ref->vm->acc, pswZero(ref->vm), pswSign(ref->vm),
+		ref->halted, (unsigned long)ref->vm->out.mem_len);
+	fprintf(fp, "  %-4s pc=%04X acc=%d Z=%d N=%d halted=%d out=%lu\n", engine_name[dut->vm->engine],
+		dut->vm->pc, dut->vm->acc, pswZero(dut->vm), pswSign(dut->vm),
+		dut->halted, (unsigned long)dut->vm->out.mem_len);
+}
+
+int diffTest(int count, UINT seed, unsigned long long budget) {
+	DiffMachine ref, dut;		// reference, device under test
+	unsigned long long total = 0, k;
+	int i, bad = 0;
+
+	diff_rand = seed ? seed : 1;
+	ref.vm = vmCreate();
+	dut.vm = vmCreate();
+	ref.vm->engine = ENGINE_SWITCH;
+	sinkMemory(&ref.vm->out);
+	sinkMemory(&dut.vm->out);
+#ifdef JIT_X86_64
+	if (dut.vm->engine == ENGINE_JIT) jitInit(dut.vm);
+#endif
+
+	for (i = 0; i < count && !bad; i++) {
+		diffGenerate(ref.vm);
+		diffReset(ref.vm, ref.vm);
+		diffReset(dut.vm, ref.vm);
+		k = diffRun(&ref, &dut, budget, &bad);
+		if (bad) {
+			printf("difftest: mismatch in program %d (seed %u) after %llu instructions\n", i, seed, k);
+			diffReport(stdout, &ref, &dut);
+			printMemory(ref.vm, "DATA (ref)", ref.vm->data_bgn, ref.vm->data_end);
+			printMemory(ref.vm, "CODE (ref)", ref.vm->code_bgn, ref.vm->code_end);
+		}
+		total += k;
+	}
+	printf("difftest: %s%s vs switch, %d programs, %llu instructions, %s\n",
+		engine_name[dut.vm->engine], dut.vm->accel ? "+accel" : "", i, total, bad ? "FAILED" : "ok");
+	vmDestroy(ref.vm);
+	vmDestroy(dut.vm);
+	return bad;
+}
+
+//========================================
+// Fuzzing harness
+// - input bytes are a program: FUZZ_DATA words for DATA at 0x0100
+//   (the inputs), the rest up to FUZZ_CODE words for CODE at 0x0200
+// - the program runs on ENGINE_SWITCH and in lockstep on every other
+//   engine and on switch with counted loops (-accel) under FUZZ_BUDGET
+//   instructions; a mismatch aborts, so the fuzzer keeps the input
+// - libFuzzer: cc -g -O1 -fsanitize=fuzzer,address -DFUZZ_LIBFUZZER pyramid.c accasm.c aot.c peephole.c simt.c -lpthread
+// - AFL:       make pyramid CC=afl-clang-fast
+//              afl-fuzz -i seeds -o findings -- ./pyramid -fuzz -
+//   (persistent mode when built with afl-clang-fast)
+// - seeds:     pyramid -fuzz-seeds dir n [-seed s]; make check runs
+//              every seed through -fuzz
+//========================================
+#define FUZZ_DATA	16		// DATA words of an input
+#define FUZZ_CODE	256		// max CODE words of an input
+#define FUZZ_BUDGET	10000	// max instructions per program and engine
+#define FUZZ_MAX	(2*(FUZZ_DATA + FUZZ_CODE))	// max used input bytes
+
+// Build the program of an input in vm
+static void fuzzLoad(AccComVM *vm, const UCHAR *data, size_t size) {
+	size_t ndata = (size < 2*FUZZ_DATA) ? size : 2*FUZZ_DATA;
+	size_t ncode = (size - ndata)/2;
+
+	if (ncode > FUZZ_CODE) ncode = FUZZ_CODE;
+	memset(vm->mem, 0, MEM_ALLOC);
+	vm->data_bgn = 0x0100;
+	vm->data_end = vm->data_bgn + 2*FUZZ_DATA;
+	memcpy(vm->mem + vm->data_bgn, data, ndata);
+	vm->code_bgn = 0x0200;
+	memcpy(vm->mem + vm->code_bgn, data + ndata, 2*ncode);
+	vm->code_end = vm->code_bgn + 2*(ncode ? ncode : 1);	// empty: one zero word, invalid
+}
+
+// Cross-check all engines on one input, abort on mismatch
+int fuzzOne(const UCHAR *data, size_t size) {
+	static AccComVM *src;			// program of the input
+	static DiffMachine ref, dut;
+	unsigned long long k;
+	int e, bad;
+
+	if (src == NULL) {
+		src = vmCreate();
+		ref.vm = vmCreate();
+		dut.vm = vmCreate();
+		ref.vm->engine = ENGINE_SWITCH;
+		sinkMemory(&ref.vm->out);
+		sinkMemory(&dut.vm->out);
+#ifdef JIT_X86_64
+		jitInit(dut.vm);
+#endif
+	}
+	fuzzLoad(src, data, size);
+	for (e = ENGINE_SWITCH; e < ENGINE_COUNT; e++) {
+		dut.vm->engine = e;
+		dut.vm->accel = (e == ENGINE_SWITCH);		// switch steps with counted loops
+		diffReset(ref.vm, src);
+		diffReset(dut.vm, src);
+		k = diffRun(&ref, &dut, FUZZ_BUDGET, &bad);
+		if (bad) {
+			fprintf(stderr, "fuzz: %s%s differs from switch after %llu instructions\n",
+				engine_name[e], dut.vm->accel ? "+accel" : "", k);
+			diffReport(stderr, &ref, &dut);
+			abort();
+		}
+	}
+	return 0;
+}
+
+#ifdef FUZZ_LIBFUZZER
+int LLVMFuzzerTestOneInput(const unsigned char *data, size_t size) {
+	return fuzzOne(data, size);
+}
+#endif
+
+// Run fuzz inputs from a file or stdin ("-")
+// - with afl-clang-fast stdin is read in AFL persistent mode
+int fuzzFile(const char *path) {
+	static UCHAR buf[FUZZ_MAX];
+	FILE *fp;
+	size_t n;
+
+#ifdef __AFL_LOOP
+	if (strcmp(path, "-") == 0) {
+		while (__AFL_LOOP(10000)) {
+			n = fread(buf, 1, sizeof(buf), stdin);
+			fuzzOne(buf, n);
+		}
+		return 0;
+	}
+#endif
+	fp = (strcmp(path, "-") == 0) ? stdin : fopen(path, "rb");
+	if (fp == NULL) {
+		fprintf(stderr, "%s: cannot open\n", path);
+		return 1;
+	}
+	n = fread(buf, 1, sizeof(buf), fp);
+	if (fp != stdin) fclose(fp);
+	return fuzzOne(buf, n);
+}
+
+// Write n seed inputs made by the difftest generator into dir
+int fuzzSeeds(const char *dir, int n, UINT seed) {
+	AccComVM *vm = vmCreate();
+	char path[1024];
+	FILE *fp;
+	int i;
+
+	diff_rand = seed ? seed : 1;
+	for (i = 0; i < n; i++) {
+		diffGenerate(vm);
+		snprintf(path, sizeof(path), "%s/seed%05d", dir, i);
+		fp = fopen(path, "wb");
+		if (fp == NULL) {
+			fprintf(stderr, "%s: cannot write\n", path);
+			vmDestroy(vm);
+			return 1;
+		}
+		fwrite(vm->mem + vm->data_bgn, 1, vm->data_end - vm->data_bgn, fp);
+		fwrite(vm->mem + vm->code_bgn, 1, vm->code_end - vm->code_bgn, fp);
+		fclose(fp);
+	}
+	vmDestroy(vm);
+	return 0;
+}
+
+//========================================
+// Benchmark
+// - run the loaded program repeatedly on every engine
+// - program output is discarded, report goes to stderr
+//========================================
+void benchmark(AccComVM *vm, UINT start_addr, double min_time) {
+	static UCHAR image[MEM_ALLOC];	// memory after input
+	int e, runs;
+	double t0, t;
+
+	memcpy(image, vm->mem, MEM_ALLOC);
+	sinkNull(&vm->out);
+	for (e = 0; e < ENGINE_COUNT; e++) {
+		vm->engine = e;
+		vm->inst_count = 0;
+		runs = 0;
+		t0 = nowSeconds();
+		do {
+			memcpy(vm->mem, image, MEM_ALLOC);
+			decodeProgram(vm);
+			vmReset(vm);
+			runProgram(vm, start_addr);
+			runs++;
+		} while ((t = nowSeconds() - t0) < min_time);
+		fprintf(stderr, "%-9s %6d runs %12llu inst %8.3f s %10.2f MIPS\n",
+			engine_name[e], runs, vm->inst_count, t, vm->inst_count/t*1e-6);
+	}
+}
+
+//========================================
+// Benchmark suite
+// - fixed corpus run on every engine, same inputs on every build, so
+//   reports of two commits or two build configurations can be diffed
+// - build: make pyramid variants (Makefile), or cc with -DWORD_MEMORY,
+//          -DMEM_CHECK, -DMEM_SIZE=n or -DPSW_EAGER; make bench runs
+//          the whole suite into bench.json
+// - cases: all, or those whose name starts with one of a comma
+//   separated list (-bench-case); lazy vs eager PSW, for example:
+//     pyramid -benchsuite -bench-case pyramid,sum-loop -bench-json lazy.json
+//     pyramid-eager -benchsuite -bench-case pyramid,sum-loop -bench-json eager.json
+// - every case runs repeatedly for at least min_time seconds per
+//   engine; memory is restored between runs without dropping the
+//   decode, block and JIT caches
+// - text report on stderr, JSON to a file or stdout
+//========================================
+typedef struct {
+	const char *name;
+	const char *src;		// assembler source, NULL: built-in pyramid
+	int height;				// built-in pyramid: Height
+} SuiteCase;
+
+static const char suite_quadratic[] =
+	"; Y = A*X^2 + B*X + C\n"
+	".data\n"
+	"A: .word 7\n" "B: .word -5\n" "C: .word 3\n" "X: .word 9\n" "Y: .word 0\n"
+	"Str: .string \"Y=\"\n"
+	".code\n"
+	"LDA X\n" "MUL X\n" "MUL A\n" "STA Y\n"
+	"LDA X\n" "MUL B\n" "ADD Y\n" "STA Y\n"
+	"LDA C\n" "ADD Y\n" "STA Y\n"
+	"PRS Str\n" "PRT Y\n" "PRC '\\n'\n" "HLT\n";
+
+static const char suite_sum[] =
+	"; S = 1 + 2 + ... + N, stored modulo 2^15\n"
+	".data\n"
+	"N: .word 30000\n" "I: .word 0\n" "S: .word 0\n" "One: .word 1\n"
+	".code\n"
+	"      LDA N\n" "      STA I\n"
+	"loop: LDA I\n" "      JZ done\n" "      ADD S\n" "      STA S\n"
+	"      LDA I\n" "      SUB One\n" "      STA I\n" "      JMP loop\n"
+	"done: PRT S\n" "      PRC '\\n'\n" "      HLT\n";
+
+static const char suite_alu[] =
+	"; counted loop of loads, arithmetic and stores\n"
+	".data\n"
+	"N: .word 20000\n" "I: .word 0\n" "A: .word 3\n" "T: .word 0\n" "One: .word 1\n"
+	".code\n"
+	"      LDA N\n" "      STA I\n"
+	"loop: LDA T\n" "      ADD A\n" "      MUL One\n" "      SUB One\n" "      STA T\n"
+	"      LDA I\n" "      SUB One\n" "      STA I\n" "      JZ done\n" "      JMP loop\n"
+	"done: PRT T\n" "      PRC '\\n'\n" "      HLT\n";
+
+static const char suite_call[] =
+	"; counted loop calling a subroutine\n"
+	".data\n"
+	"N: .word 20000\n" "I: .word 0\n" "T: .word 0\n" "One: .word 1\n"
+	".code\n"
+	"      LDA N\n" "      STA I\n"
+	"loop: CALL inc\n" "      LDA I\n" "      SUB One\n" "      STA I\n" "      JZ done\n" "      JMP loop\n"
+	"done: PRT T\n" "      PRC '\\n'\n" "      HLT\n"
+	"inc:  LDA T\n" "      IAC\n" "      STA T\n" "      RET\n";
+
+static const char suite_print[] =
+	"; counted loop printing 8 chars per iteration\n"
+	".data\n"
+	"N: .word 5000\n" "I: .word 0\n" "One: .word 1\n"
+	".code\n"
+	"      LDA N\n" "      STA I\n"
+	"loop: PRC '*'\n" "      PRC '*'\n" "      PRC '*'\n" "      PRC '*'\n"
+	"      PRC '*'\n" "      PRC '*'\n" "      PRC '*'\n" "      PRC '\\n'\n"
+	"      LDA I\n" "      SUB One\n" "      STA I\n" "      JZ done\n" "      JMP loop\n"
+	"done: HLT\n";
+
+static const SuiteCase suite_case[] = {
+	{ "pyramid-10",   NULL, 10 },
+	{ "pyramid-100",  NULL, 100 },
+	{ "pyramid-1000", NULL, 1000 },
+	{ "quadratic",    suite_quadratic, 0 },
+	{ "sum-loop",     suite_sum, 0 },
+	{ "loop-alu",     suite_alu, 0 },
+	{ "loop-call",    suite_call, 0 },
+	{ "loop-print",   suite_print, 0 },
+	{ NULL, NULL, 0 }
+};
+
+static long peakRssKb() {
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru) != 0) return 0;
+	return ru.ru_maxrss;		// KiB on Linux
+}
+
+// Does name start with one of the comma separated prefixes in list
+static int suiteSelected(const char *name, const char *list) {
+	const char *p, *end;
+	size_t len;
+
+	if (list == NULL) return 1;
+	for (p = list; *p != '\0'; p = (*end == ',') ? end + 1 : end) {
+		end = strchr(p, ',');
+		if (end == NULL) end = p + strlen(p);
+		len = (size_t)(end - p);
+		if (len > 0 && strncmp(name, p, len) == 0) return 1;
+	}
+	return 0;
+}
+
+// Run the suite, JSON report to json_path ("-": stdout, NULL: none)
+int benchSuite(const char *json_path, const char *cases, double min_time) {
+	static Program prog;
+	static MemImage image;
+	const SuiteCase *c;
+	AccComVM *vm;
+	FILE *fp = NULL;
+	char *src;
+	UINT start_addr;
+	unsigned long long bytes;
+	double t0, t, mips;
+	int e, runs, rows = 0;
+
+	if (json_path != NULL) {
+		fp = (strcmp(json_path, "-") == 0) ? stdout : fopen(json_path, "w");
+		if (fp == NULL) {
+			fprintf(stderr, "%s: cannot write\n", json_path);
+			return 1;
+		}
+		fprintf(fp, "{\n  \"config\": {\"mem_size\": %u, \"word_memory\": %d, \"mem_check\": %d, "
+			"\"psw_eager\": %d, \"jit\": %d, \"accel\": %d, \"compiler\": \"%s\"},\n", MEM_SIZE,
+#ifdef WORD_MEMORY
+			1,
+#else
+			0,
+#endif
+#ifdef MEM_CHECK
+			1,
+#else
+			0,
+#endif
+#ifdef PSW_EAGER
+			1,
+#else
+			0,
+#endif
+#ifdef JIT_X86_64
+			1,
+#else
+			0,
+#endif
+			loop_accel,
+#ifdef __VERSION__
+			__VERSION__
+#else
+			"unknown"
+#endif
+			);
+		fprintf(fp, "  \"min_time\": %.3f,\n  \"results\": [", min_time);
+	}
+
+	for (c = suite_case; c->name != NULL; c++) {
+		if (!suiteSelected(c->name, cases)) continue;
+		vm = vmCreate();
+		sinkNull(&vm->out);
+		if (c->src == NULL) {
+			start_addr = loadProgram(vm);
+			writeWord(vm, (UINT)inputAddr(vm, "Height"), cint2accnum(c->height));	// built-in: 0x0100
+		}
+		else {
+			src = strdup(c->src);
+			if (src == NULL || asmSource(&prog, c->name, src) != 0) {
+				fprintf(stderr, "benchsuite: %s does not assemble\n", c->name);
+				exit(-1);
+			}
+			free(src);
+			start_addr = programLoad(vm, &prog);
+		}
+		imageSave(vm, &image);
+
+		for (e = 0; e < ENGINE_COUNT; e++) {
+			vm->engine = e;
+			vm->inst_count = 0;
+			vm->out.dropped = 0;
+			runs = 0;
+			t0 = nowSeconds();
+			do {
+				imageRestore(vm, &image);
+				runProgram(vm, start_addr);
+				runs++;
+			} while ((t = nowSeconds() - t0) < min_time);
+			bytes = vm->out.dropped;
+			mips = vm->inst_count/t*1e-6;
+			fprintf(stderr, "%-12s %-9s %7d runs %12llu inst %8.3f s %9.2f MIPS %8.3f ns/inst %9.2f MB/s out\n",
+				c->name, engine_name[e], runs, vm->inst_count, t, mips,
+				vm->inst_count ? t*1e9/vm->inst_count : 0.0, bytes/t*1e-6);
+			if (fp != NULL) {
+				fprintf(fp, "%s\n    {\"case\": \"%s\", \"engine\": \"%s\", \"runs\": %d, "
+					"\"instructions\": %llu, \"seconds\": %.6f, \"mips\": %.3f, \"ns_per_inst\": %.4f, "
+					"\"output_bytes_per_run\": %llu, \"output_bytes_per_s\": %.0f}",
+					rows++ ? "," : "", c->name, engine_name[e], runs, vm->inst_count, t, mips,
+					vm->inst_count ? t*1e9/vm->inst_count : 0.0, bytes/runs, bytes/t);
+			}
+		}
+		vmDestroy(vm);
+	}
+
+	fprintf(stderr, "peak RSS %ld KiB\n", peakRssKb());
+	if (fp != NULL) {
+		fprintf(fp, "\n  ],\n  \"peak_rss_kb\": %ld\n}\n", peakRssKb());
+		if (fp != stdout) fclose(fp);
+	}
+	return 0;
+}
+
+//========================================
+// Parallel sweep
+// - run the program for Height = lo ~ hi on a pool of threads,
+//   every run on its own machine with its own output buffer
+// - outputs are printed in Height order when all runs are done
+//========================================
+static void *sweepWorker(void *arg) {
+	SweepPool *pool = arg;
+	AccComVM *vm;		// reused for every job of this thread
+	SweepJob *job;
+	UINT start_addr;
+
+	if (pool->simt != NULL) return simtWorker(arg);
+	vm = vmCreate();
+	sinkMemory(&vm->out);
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		job = (pool->next < pool->count) ? &pool->job[pool->next++] : NULL;
+		pthread_mutex_unlock(&pool->lock);
+		if (job == NULL) break;
+
+		vmReset(vm);
+		start_addr = loadProgram(vm);
+		writeWord(vm, pool->height, cint2accnum(job->height));
+		job->exit_code = runProgram(vm, start_addr);
+
+		// hand the collected output over to the job
+		job->buf = vm->out.mem;
+		job->len = vm->out.mem_len;
+		vm->out.mem = NULL;
+		vm->out.mem_len = vm->out.mem_cap = 0;
+	}
+	vmDestroy(vm);
+	return NULL;
+}
+
+// - simt: SIMT kernel name, NULL: one machine per run
+int sweep(int lo, int hi, int threads, const char *simt) {
+	SweepPool pool;
+	AccComVM *vm;
+	pthread_t *tid;
+	double t0, t;
+	unsigned long long bytes = 0;
+	int i, height;
+
+	if (hi < lo) return 1;
+	vm = vmCreate();
+	loadProgram(vm);
+	height = inputAddr(vm, "Height");
+	vmDestroy(vm);
+	if (height < 0) {
+		fprintf(stderr, "sweep: the program has no input variable Height\n");
+		return 1;
+	}
+	pool.height = (UINT)height;
+	if (threads < 1) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads < 1) threads = 1;
+
+	pool.count = hi - lo + 1;
+	pool.next = 0;
+	pool.simt = simt;
+	pool.job = calloc(pool.count, sizeof(SweepJob));
+	tid = calloc(threads, sizeof(pthread_t));
+	if (pool.job == NULL || tid == NULL) {
+		printf("Error: out of memory");
+		exit(-1);
+	}
+	pthread_mutex_init(&pool.lock, NULL);
+	for (i = 0; i < pool.count; i++) pool.job[i].height = lo + i;
+
+	t0 = nowSeconds();
+	for (i = 0; i < threads; i++) pthread_create(&tid[i], NULL, sweepWorker, &pool);
+	for (i = 0; i < threads; i++) pthread_join(tid[i], NULL);
+	t = nowSeconds() - t0;
+
+	for (i = 0; i < pool.count; i++) {
+		printf("*** Height = %d ***\n", pool.job[i].height);
+		fwrite(pool.job[i].buf, 1, pool.job[i].len, stdout);
+		printf("*** Exit %d ***\n", pool.job[i].exit_code);
+		bytes += pool.job[i].len;
+		free(pool.job[i].buf);
+	}
+	fflush(stdout);
+	fprintf(stderr, "sweep: %d runs on %d threads%s%s, %llu output bytes, %.3f s\n",
+		pool.count, threads, simt ? ", simt " : "", simt ? simt : "", bytes, t);
+
+	pthread_mutex_destroy(&pool.lock);
+	free(pool.job);
+	free(tid);
+	return 0;
+}
+
+//========================================
+// Batch mode
+// - one program image, one run per input line
+// - input line: name=value ... (name: input variable, label or hex address)
+// - output record per run: header, program output, exit state
+//========================================
+int batch(const char *path, int null_out) {
+	static MemImage image;
+	AccComVM *vm = vmCreate();
+	FILE *in = (strcmp(path, "-") == 0) ? stdin : fopen(path, "r");
+	char line[1024], text[1024], *tok, *eq, *end;
+	UINT start_addr;
+	int run = 0, lineno = 0, addr, exit_code, bad = 0;
+	long value;
+	double t0, t;
+
+	if (in == NULL) {
+		fprintf(stderr, "batch: cannot open %s\n", path);
+		vmDestroy(vm);
+		return 1;
+	}
+
+	if (null_out) sinkNull(&vm->out);
+	instrumentEnable(vm);
+	start_addr = loadProgram(vm);
+	imageSave(vm, &image);
+
+	t0 = nowSeconds();
+	while (!bad && fgets(line, sizeof(line), in) != NULL) {
+		lineno++;
+		line[strcspn(line, "\r\n#")] = '\0';
+		if (strspn(line, " \t") == strlen(line)) continue;		// blank or comment
+
+		strcpy(text, line);		// strtok() cuts line, text is for the header
+		imageRestore(vm, &image);
+		for (tok = strtok(line, " \t"); tok != NULL; tok = strtok(NULL, " \t")) {
+			eq = strchr(tok, '=');
+			if (eq != NULL) {
+				*eq = '\0';
+				addr = inputAddr(vm, tok);
+				*eq = '=';
+				value = strtol(eq + 1, &end, 10);
+			}
+			if (eq == NULL || addr < 0 || end == eq + 1 || *end != '\0') {
+				fprintf(stderr, "batch: line %d: bad input '%s'\n", lineno, tok);
+				bad = 1;
+				break;
+			}
+			writeWord(vm, (UINT)addr, cint2accnum((int)value));
+		}
+		if (bad) break;
+
+		printf("*** Run %d: %s ***\n", ++run, text);
+		exit_code = runProgram(vm, start_addr);
+		printf("*** Exit %d ***\n", exit_code);
+	}
+	t = nowSeconds() - t0;
+	fflush(stdout);
+	fprintf(stderr, "batch: %d runs, %llu instructions, %.3f s\n", run, vm->inst_count, t);
+	instrumentReport(vm);
+
+	if (in != stdin) fclose(in);
+	vmDestroy(vm);
+	return bad;
+}
+
+//========================================
+// Main Function
+//========================================
+// Usage: pyramid [-e switch|table|threaded|block|jit] [-bench]
+//                [-difftest count [-seed n]]
+//                [-sweep lo hi [-threads n] [-simt [-simt-isa avx2|sse4.1|scalar]]] [-batch file|-] [-null]
+//                [-profile] [-profile-json file|-] [-trace file [-trace-size n]]
+//                [-trace-decode file [-last n] [-pc lo hi]]
+//                [-load source|image] [-dump] [-asm source [-o image [-strip]]]
+//                [-checkpoint file [-every n]] [-resume file]
+//                [-budget n] [-timeout sec] [-accel]
+//                [-benchsuite [-bench-json file|-] [-bench-time sec] [-bench-case names]]
+//                [-fuzz file|-] [-fuzz-seeds dir n [-seed n]]
+//                [-aot file.c] [-opt image [-opt-verify]]
+#ifndef FUZZ_LIBFUZZER		// libFuzzer brings its own main()
+int main(int argc, char *argv[]) {
+	AccComVM *vm;		// machine for a single run
+	int exit_code;		// 0: normal exit, 1: error exit, 2: budget, 3: timeout
+	UINT start_addr;	// start address of program
+	int bench = 0;		// run benchmark instead of a single run
+	int bench_suite = 0;		// run the benchmark suite
+	char *fuzz_file = NULL;		// fuzz input to cross-check
+	char *fuzz_seeds = NULL;	// directory for generated fuzz inputs
+	int fuzz_count = 0;
+	char *bench_json = NULL;	// JSON report of the suite
+	char *bench_case = NULL;	// suite cases to run, NULL: all
+	double bench_time = 0.2;	// min seconds per suite case and engine
+	int difftest = 0;	// # of random programs for differential test
+	UINT seed = 1;		// random seed for differential test
+	int sweep_lo = 0, sweep_hi = -1;	// Height range for parallel sweep
+	int threads = 0;	// # of sweep threads, 0: # of cores
+	int simt = 0;		// sweep runs as SIMT lanes
+	char *batch_file = NULL;	// input lines for batch mode
+	int null_out = 0;	// discard program output
+	char *trace_decode = NULL;	// trace file to print
+	char *asm_file = NULL;		// source to assemble
+	char *out_file = NULL;		// image written by the assembler
+	char *load_file = NULL;		// program to run instead of the built-in one
+	int strip = 0;		// leave symbols out of the image
+	int dump = 0;		// print DATA/CODE sections after loading
+	char *ckpt_file = NULL;		// checkpoint records of the run
+	unsigned long long ckpt_every = 0;	// checkpoint interval, 0: SNAP_EVERY
+	char *resume_file = NULL;	// continue the run saved in a checkpoint file
+	char *aot_file = NULL;		// C file written by the recompiler
+	char *opt_file = NULL;		// image written by the peephole optimizer
+	int opt_verify = 0;		// run original and optimized program side by side
+	static Program prog;
+	UINT trace_last = 0, trace_lo = 0, trace_hi = 0xFFFF;	// trace window
+	int i, e;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+			for (e = 0; e < ENGINE_COUNT; e++)
+				if (strcmp(argv[i + 1], engine_name[e]) == 0) break;
+			if (e == ENGINE_COUNT) {
+				fprintf(stderr, "unknown engine: %s\n", argv[i + 1]);
+				return 1;
+			}
+			engine = e;
+			i++;
+		}
+		else if (strcmp(argv[i], "-bench") == 0) bench = 1;
+		else if (strcmp(argv[i], "-benchsuite") == 0) bench_suite = 1;
+		else if (strcmp(argv[i], "-fuzz") == 0 && i + 1 < argc) fuzz_file = argv[++i];
+		else if (strcmp(argv[i], "-fuzz-seeds") == 0 && i + 2 < argc) {
+			fuzz_seeds = argv[++i];
+			fuzz_count = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-bench-json") == 0 && i + 1 < argc) bench_json = argv[++i];
+		else if (strcmp(argv[i], "-bench-case") == 0 && i + 1 < argc) bench_case = argv[++i];
+		else if (strcmp(argv[i], "-bench-time") == 0 && i + 1 < argc) bench_time = atof(argv[++i]);
+		else if (strcmp(argv[i], "-difftest") == 0 && i + 1 < argc) difftest = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc) seed = (UINT)strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-sweep") == 0 && i + 2 < argc) {
+			sweep_lo = atoi(argv[++i]);
+			sweep_hi = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-threads") == 0 && i + 1 < argc) threads = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-simt") == 0) simt = 1;
+		else if (strcmp(argv[i], "-simt-isa") == 0 && i + 1 < argc) simt_isa = argv[++i];
+		else if (strcmp(argv[i], "-batch") == 0 && i + 1 < argc) batch_file = argv[++i];
+		else if (strcmp(argv[i], "-null") == 0) null_out = 1;
+		else if (strcmp(argv[i], "-asm") == 0 && i + 1 < argc) asm_file = argv[++i];
+		else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) out_file = argv[++i];
+		else if (strcmp(argv[i], "-load") == 0 && i + 1 < argc) load_file = argv[++i];
+		else if (strcmp(argv[i], "-strip") == 0) strip = 1;
+		else if (strcmp(argv[i], "-dump") == 0) dump = 1;
+		else if (strcmp(argv[i], "-checkpoint") == 0 && i + 1 < argc) ckpt_file = argv[++i];
+		else if (strcmp(argv[i], "-every") == 0 && i + 1 < argc) ckpt_every = strtoull(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-resume") == 0 && i + 1 < argc) resume_file = argv[++i];
+		else if (strcmp(argv[i], "-budget") == 0 && i + 1 < argc) run_budget = strtoull(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-timeout") == 0 && i + 1 < argc) run_timeout = atof(argv[++i]);
+		else if (strcmp(argv[i], "-accel") == 0) loop_accel = 1;
+		else if (strcmp(argv[i], "-aot") == 0 && i + 1 < argc) aot_file = argv[++i];
+		else if (strcmp(argv[i], "-opt") == 0 && i + 1 < argc) opt_file = argv[++i];
+		else if (strcmp(argv[i], "-opt-verify") == 0) opt_verify = 1;
+		else if (strcmp(argv[i], "-profile") == 0) profile_text = 1;
+		else if (strcmp(argv[i], "-profile-json") == 0 && i + 1 < argc) profile_json = argv[++i];
+		else if (strcmp(argv[i], "-trace") == 0 && i + 1 < argc) trace_file = argv[++i];
+		else if (strcmp(argv[i], "-trace-size") == 0 && i + 1 < argc) trace_size = (UINT)atoi(argv[++i]);
+		else if (strcmp(argv[i], "-trace-decode") == 0 && i + 1 < argc) trace_decode = argv[++i];
+		else if (strcmp(argv[i], "-last") == 0 && i + 1 < argc) trace_last = (UINT)atoi(argv[++i]);
+		else if (strcmp(argv[i], "-pc") == 0 && i + 2 < argc) {
+			trace_lo = (UINT)strtoul(argv[++i], NULL, 16);
+			trace_hi = (UINT)strtoul(argv[++i], NULL, 16);
+		}
+		else {
+			fprintf(stderr, "usage: %s [-e switch|table|threaded|block|jit] [-bench] "
+				"[-difftest count [-seed n]] [-sweep lo hi [-threads n] [-simt [-simt-isa avx2|sse4.1|scalar]]] [-batch file|-] [-null] "
+				"[-profile] [-profile-json file|-] [-trace file [-trace-size n]] "
+				"[-trace-decode file [-last n] [-pc lo hi]] "
+				"[-load source|image] [-dump] [-asm source [-o image [-strip]]] "
+				"[-checkpoint file [-every n]] [-resume file] [-budget n] [-timeout sec] [-accel] "
+				"[-benchsuite [-bench-json file|-] [-bench-time sec] [-bench-case names]] "
+				"[-fuzz file|-] [-fuzz-seeds dir n [-seed n]] [-aot file.c] [-opt image [-opt-verify]]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (asm_file != NULL) return assemble(asm_file, out_file, !strip);
+	if (bench_suite) return benchSuite(bench_json, bench_case, bench_time);		// fixed corpus, -load does not apply
+	if (load_file != NULL) {
+		if (programOpen(&prog, load_file)) return 1;
+		program = &prog;
+	}
+	if (trace_decode != NULL) return traceDecode(trace_decode, trace_last, trace_lo, trace_hi);
+	if (difftest > 0) return diffTest(difftest, seed, 10000);
+	if (fuzz_file != NULL) return fuzzFile(fuzz_file);
+	if (fuzz_seeds != NULL) return fuzzSeeds(fuzz_seeds, fuzz_count, seed);
+	if (sweep_hi >= sweep_lo) {
+		const SimtKernel *kern = simt ? simtKernel(simt_isa) : NULL;
+		if (simt && kern == NULL) {
+			fprintf(stderr, "simt: %s not supported on this CPU\n", simt_isa);
+			return 1;
+		}
+		if (kern != NULL && (run_budget != 0 || run_timeout > 0 || !simtUsable())) {
+			fprintf(stderr, "simt: needs Height in DATA section and no -budget/-timeout, one machine per run\n");
+			kern = NULL;
+		}
+		return sweep(sweep_lo, sweep_hi, threads, kern ? kern->name : NULL);
+	}
+	if (batch_file != NULL) return batch(batch_file, null_out);
+	if (opt_file != NULL) return peephole(opt_file, opt_verify);
+	if (aot_file != NULL) {
+		vm = vmCreate();
+		exit_code = recompile(vm, loadProgram(vm), aot_file);
+		vmDestroy(vm);
+		return exit_code;
+	}
+
+	vm = vmCreate();
+	if (null_out) sinkNull(&vm->out);
+	instrumentEnable(vm);
+
+	printf("========================================\n");
+	printf(" AccCom: Accumulator Computer Simulator\n");
+	printf("     modified by 201602141 Yoo Hwanseung\n");
+	printf("========================================\n");
+
+	if (resume_file != NULL) {
+		printf("*** Resume ***\n");
+		if (snapshotRead(vm, resume_file)) return 1;
+		start_addr = vm->pc;
+	}
+	else {
+		printf("*** Load ***\n");
+		start_addr = loadProgram(vm);
+	}
+
+	// print memory for verify
+	if (dump) {
+		printMemory(vm, "DATA", vm->data_bgn, vm->data_end);
+		printMemory(vm, "CODE", vm->code_bgn, vm->code_end);
+	}
+
+	if (resume_file == NULL) {
+		printf("*** Input ***\n");
+		inputData(vm);
+	}
+	if (ckpt_file != NULL && checkpointEnable(vm, ckpt_file, ckpt_every)) return 1;
+
+	if (bench) {
+		benchmark(vm, start_addr, 1.0);
+		vmDestroy(vm);
+		return 0;
+	}
 
 	printf("*** Run ***\n");
-	exit_code = runProgram(start_addr);
+	exit_code = runProgram(vm, start_addr);
 
 	printf("*** Exit %d ***\n", exit_code);
+	fflush(stdout);
+	instrumentReport(vm);
+	vmDestroy(vm);
+	programClose(&prog);
+	return exit_code;
 }
+#endif
@@ -0,0 +1,51 @@
+; pyramid.s - print a pyramid of '#' with Height rows
+;
+;   pyramid -load pyramid.s
+;   pyramid -asm pyramid.s -o pyramid.img
+;
+; same program as the built-in one in loadProgram()
+
+		.data	0x0100
+Height:	.word	0		; input
+N:		.word	0		; copy of Height
+Row:	.word	1		; current row, 1..Height
+K:		.word	0		; '#' count of the row
+Col:	.word	0		; ' ' count of the row
+One:	.word	1
+
+		.code	0x0200
+		LDA		Height
+		STA		N
+row:	LDA		N			; while (Row <= Height)
+		SUB		Row
+		JN		done
+		LDA		Row			;   Col = Row + 1
+		IAC
+		STA		Col
+space:	LDA		N			;   while (Col <= Height) print ' '
+		SUB		Col
+		JN		star0
+		PRC		' '
+		LDA		Col
+		IAC
+		STA		Col
+		JMP		space
+star0:	LDA		One			;   K = 1
+		STA		K
+star:	LDA		One			;   while (K <= 2*Row - 1) print '#'
+		IAC
+		MUL		Row
+		SUB		One
+		SUB		K
+		JN		eol
+		PRC		'#'
+		LDA		K
+		IAC
+		STA		K
+		JMP		star
+eol:	PRC		'\n'
+		LDA		Row			;   Row++
+		IAC
+		STA		Row
+		JMP		row
+done:	HLT
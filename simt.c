@@ -0,0 +1,591 @@
+/*
+ * simt.c - SIMT lockstep sweep (-sweep lo hi -simt)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "accvm.h"
+
+//========================================
+// SIMT sweep
+// - -sweep lo hi -simt: runs of one program that differ only in DATA
+//   step together, SIMT_LANES machines per group in structure-of-
+//   arrays layout: ACC vector, pc vector, DATA matrix (word k of lane
+//   i at word[k*SIMT_LANES + i], raw AccCom numbers), CODE shared
+// - one instruction at a time for the lanes at the group pc (mask);
+//   after a jump the group goes on at the lowest lane pc, so lanes
+//   that took different sides of JZ/JN meet again where the paths
+//   join; lanes that ended are packed out of the vectors (regroup)
+// - PSW is not stored: it follows ACC after the first instruction,
+//   which sees 0, 0, as in the scalar engines
+// - kernels: scalar, SSE4.1 and AVX2 for LDA/ADD/SUB/MUL/IAC/STA and
+//   JZ/JN, picked by CPU at run time or by -simt-isa
+// - CALL/RET/PUSH/POP, stores and loads outside the DATA words, and
+//   jumps out of CODE section move the lanes at that pc to scalar
+//   machines that finish the run
+//========================================
+#define SIMT_LANES	64			// lanes per group, a multiple of 8
+#define SIMT_DONE	0x7FFFFFFF	// lane pc of an ended run
+
+typedef struct {
+	int  n;					// lanes in the vectors
+	int  live;				// lanes still running
+	int  pc;				// pc of the masked lanes
+	int  wait;				// lowest pc of the other lanes
+	int  first;				// the first instruction has not run
+	int  acc[SIMT_LANES];
+	int  lpc[SIMT_LANES];	// pc of each lane, SIMT_DONE: ended
+	int  mask[SIMT_LANES];	// -1: lane runs at pc
+	int  bcast[SIMT_LANES];	// word outside DATA, same in every lane
+	int *word;				// DATA matrix
+	SweepJob *job[SIMT_LANES];
+} SimtGroup;
+
+static int simtNone(void) { return 1; }
+
+// AccCom number <-> int, as accnum2cint() / cint2accnum()
+static inline int simtDec(int w) {
+	return (w & 0x8000) ? -(w & 0x7FFF) : (w & 0x7FFF);
+}
+
+static inline int simtEnc(int a) {
+	return ((a < 0) ? 0x8000 : 0) | ((a < 0 ? -(UINT)a : (UINT)a) & 0x7FFF);
+}
+
+static inline int simtCond(int op, int acc) {
+	return (op == 0x9) ? acc == 0 : acc < 0;
+}
+
+// Scalar kernels, also the tails of the vector ones
+static void scalarLoad(int *acc, const int *mask, const int *w, int n) {
+	int i;
+	for (i = 0; i < n; i++) if (mask[i]) acc[i] = simtDec(w[i]);
+}
+
+static void scalarArith(int op, int *acc, const int *mask, const int *w, int n) {
+	int i;
+	for (i = 0; i < n; i++) {
+		if (!mask[i]) continue;
+		if (op == 0x3) acc[i] = (int)((UINT)acc[i] + (UINT)simtDec(w[i]));
+		else if (op == 0x4) acc[i] = (int)((UINT)acc[i] - (UINT)simtDec(w[i]));
+		else acc[i] = (int)((UINT)acc[i]*(UINT)simtDec(w[i]));
+	}
+}
+
+static void scalarIac(int *acc, const int *mask, int n) {
+	int i;
+	for (i = 0; i < n; i++) if (mask[i]) acc[i] = (int)((UINT)acc[i] + 1);
+}
+
+static void scalarStore(const int *acc, const int *mask, int *w, int n) {
+	int i;
+	for (i = 0; i < n; i++) if (mask[i]) w[i] = simtEnc(acc[i]);
+}
+
+// Return 1: some lanes jump, 2: some fall through, 3: both
+static int scalarBranch(int op, const int *acc, const int *mask, int *lpc, int target, int next, int n) {
+	int i, c, r = 0;
+	for (i = 0; i < n; i++) {
+		if (!mask[i]) continue;
+		c = simtCond(op, acc[i]);
+		lpc[i] = c ? target : next;
+		r |= c ? 1 : 2;
+	}
+	return r;
+}
+
+// Also the next lowest pc in *wait
+static int scalarSelect(const int *lpc, int *mask, int n, int *wait) {
+	int i, pc = SIMT_DONE, w = SIMT_DONE;
+	for (i = 0; i < n; i++) {
+		if (lpc[i] < pc) { w = pc; pc = lpc[i]; }
+		else if (lpc[i] > pc && lpc[i] < w) w = lpc[i];
+	}
+	for (i = 0; i < n; i++) mask[i] = (lpc[i] == pc) ? -1 : 0;
+	*wait = w;
+	return pc;
+}
+
+static const SimtKernel simt_scalar = {
+	"scalar", simtNone, scalarLoad, scalarArith, scalarIac, scalarStore, scalarBranch, scalarSelect
+};
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+
+// 4 lanes: sign-magnitude words to int, int to words
+#define SSE_DEC(w)	({ __m128i m_ = _mm_and_si128((w), _mm_set1_epi32(0x7FFF));		\
+	__m128i s_ = _mm_srai_epi32(_mm_slli_epi32((w), 16), 31);						\
+	_mm_sub_epi32(_mm_xor_si128(m_, s_), s_); })
+#define SSE_ENC(a)	_mm_or_si128(_mm_and_si128(_mm_srai_epi32((a), 31), _mm_set1_epi32(0x8000)),	\
+	_mm_and_si128(_mm_abs_epi32(a), _mm_set1_epi32(0x7FFF)))
+
+__attribute__((target("sse4.1"))) static int sseSupported(void) {
+	return __builtin_cpu_supports("sse4.1");
+}
+
+__attribute__((target("sse4.1"))) static void sseLoad(int *acc, const int *mask, const int *w, int n) {
+	int i;
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m128i m = _mm_loadu_si128((const __m128i *)(mask + i));
+		__m128i x = _mm_loadu_si128((const __m128i *)(w + i));
+		__m128i a = _mm_loadu_si128((const __m128i *)(acc + i));
+		_mm_storeu_si128((__m128i *)(acc + i), _mm_blendv_epi8(a, SSE_DEC(x), m));
+	}
+	scalarLoad(acc + i, mask + i, w + i, n - i);
+}
+
+__attribute__((target("sse4.1"))) static void sseArith(int op, int *acc, const int *mask, const int *w, int n) {
+	int i;
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m128i m = _mm_loadu_si128((const __m128i *)(mask + i));
+		__m128i x = _mm_loadu_si128((const __m128i *)(w + i));
+		__m128i a = _mm_loadu_si128((const __m128i *)(acc + i));
+		__m128i r = SSE_DEC(x);
+		r = (op == 0x3) ? _mm_add_epi32(a, r) : (op == 0x4) ? _mm_sub_epi32(a, r) : _mm_mullo_epi32(a, r);
+		_mm_storeu_si128((__m128i *)(acc + i), _mm_blendv_epi8(a, r, m));
+	}
+	scalarArith(op, acc + i, mask + i, w + i, n - i);
+}
+
+__attribute__((target("sse4.1"))) static void sseIac(int *acc, const int *mask, int n) {
+	int i;
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m128i m = _mm_loadu_si128((const __m128i *)(mask + i));
+		__m128i a = _mm_loadu_si128((const __m128i *)(acc + i));
+		_mm_storeu_si128((__m128i *)(acc + i), _mm_sub_epi32(a, m));		// mask lanes are -1
+	}
+	scalarIac(acc + i, mask + i, n - i);
+}
+
+__attribute__((target("sse4.1"))) static void sseStore(const int *acc, const int *mask, int *w, int n) {
+	int i;
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m128i m = _mm_loadu_si128((const __m128i *)(mask + i));
+		__m128i x = _mm_loadu_si128((const __m128i *)(w + i));
+		__m128i a = _mm_loadu_si128((const __m128i *)(acc + i));
+		_mm_storeu_si128((__m128i *)(w + i), _mm_blendv_epi8(x, SSE_ENC(a), m));
+	}
+	scalarStore(acc + i, mask + i, w + i, n - i);
+}
+
+__attribute__((target("sse4.1"))) static int sseBranch(int op, const int *acc, const int *mask, int *lpc, int target, int next, int n) {
+	__m128i t = _mm_set1_epi32(target), f = _mm_set1_epi32(next), z = _mm_setzero_si128();
+	int i, r = 0;
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m128i m = _mm_loadu_si128((const __m128i *)(mask + i));
+		__m128i a = _mm_loadu_si128((const __m128i *)(acc + i));
+		__m128i p = _mm_loadu_si128((const __m128i *)(lpc + i));
+		__m128i c = (op == 0x9) ? _mm_cmpeq_epi32(a, z) : _mm_cmplt_epi32(a, z);
+		_mm_storeu_si128((__m128i *)(lpc + i), _mm_blendv_epi8(p, _mm_blendv_epi8(f, t, c), m));
+		r |= (_mm_movemask_epi8(_mm_and_si128(c, m)) ? 1 : 0) | (_mm_movemask_epi8(_mm_andnot_si128(c, m)) ? 2 : 0);
+	}
+	return r | scalarBranch(op, acc + i, mask + i, lpc + i, target, next, n - i);
+}
+
+__attribute__((target("sse4.1"))) static inline int sseMin(__m128i x) {
+	x = _mm_min_epi32(x, _mm_shuffle_epi32(x, 0x4E));
+	x = _mm_min_epi32(x, _mm_shuffle_epi32(x, 0xB1));
+	return _mm_cvtsi128_si32(x);
+}
+
+__attribute__((target("sse4.1"))) static int sseSelect(const int *lpc, int *mask, int n, int *wait) {
+	__m128i lo = _mm_set1_epi32(SIMT_DONE), hi = lo, p, x, e;
+	int i, pc, w;
+	for (i = 0; i + 4 <= n; i += 4) lo = _mm_min_epi32(lo, _mm_loadu_si128((const __m128i *)(lpc + i)));
+	pc = sseMin(lo);
+	for (; i < n; i++) if (lpc[i] < pc) pc = lpc[i];
+	p = _mm_set1_epi32(pc);
+	for (i = 0; i + 4 <= n; i += 4) {
+		x = _mm_loadu_si128((const __m128i *)(lpc + i));
+		e = _mm_cmpeq_epi32(x, p);
+		_mm_storeu_si128((__m128i *)(mask + i), e);
+		hi = _mm_min_epi32(hi, _mm_blendv_epi8(x, _mm_set1_epi32(SIMT_DONE), e));	// lanes above pc
+	}
+	w = sseMin(hi);
+	for (; i < n; i++) {
+		mask[i] = (lpc[i] == pc) ? -1 : 0;
+		if (lpc[i] > pc && lpc[i] < w) w = lpc[i];
+	}
+	*wait = w;
+	return pc;
+}
+
+static const SimtKernel simt_sse = {
+	"sse4.1", sseSupported, sseLoad, sseArith, sseIac, sseStore, sseBranch, sseSelect
+};
+
+// 8 lanes
+#define AVX_DEC(w)	({ __m256i m_ = _mm256_and_si256((w), _mm256_set1_epi32(0x7FFF));		\
+	__m256i s_ = _mm256_srai_epi32(_mm256_slli_epi32((w), 16), 31);						\
+	_mm256_sub_epi32(_mm256_xor_si256(m_, s_), s_); })
+#define AVX_ENC(a)	_mm256_or_si256(_mm256_and_si256(_mm256_srai_epi32((a), 31), _mm256_set1_epi32(0x8000)),	\
+	_mm256_and_si256(_mm256_abs_epi32(a), _mm256_set1_epi32(0x7FFF)))
+
+__attribute__((target("avx2"))) static int avxSupported(void) {
+	return __builtin_cpu_supports("avx2");
+}
+
+__attribute__((target("avx2"))) static void avxLoad(int *acc, const int *mask, const int *w, int n) {
+	int i;
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m256i m = _mm256_loadu_si256((const __m256i *)(mask + i));
+		__m256i x = _mm256_loadu_si256((const __m256i *)(w + i));
+		__m256i a = _mm256_loadu_si256((const __m256i *)(acc + i));
+		_mm256_storeu_si256((__m256i *)(acc + i), _mm256_blendv_epi8(a, AVX_DEC(x), m));
+	}
+	scalarLoad(acc + i, mask + i, w + i, n - i);
+}
+
+__attribute__((target("avx2"))) static void avxArith(int op, int *acc, const int *mask, const int *w, int n) {
+	int i;
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m256i m = _mm256_loadu_si256((const __m256i *)(mask + i));
+		__m256i x = _mm256_loadu_si256((const __m256i *)(w + i));
+		__m256i a = _mm256_loadu_si256((const __m256i *)(acc + i));
+		__m256i r = AVX_DEC(x);
+		r = (op == 0x3) ? _mm256_add_epi32(a, r) : (op == 0x4) ? _mm256_sub_epi32(a, r) : _mm256_mullo_epi32(a, r);
+		_mm256_storeu_si256((__m256i *)(acc + i), _mm256_blendv_epi8(a, r, m));
+	}
+	scalarArith(op, acc + i, mask + i, w + i, n - i);
+}
+
+__attribute__((target("avx2"))) static void avxIac(int *acc, const int *mask, int n) {
+	int i;
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m256i m = _mm256_loadu_si256((const __m256i *)(mask + i));
+		__m256i a = _mm256_loadu_si256((const __m256i *)(acc + i));
+		_mm256_storeu_si256((__m256i *)(acc + i), _mm256_sub_epi32(a, m));
+	}
+	scalarIac(acc + i, mask + i, n - i);
+}
+
+__attribute__((target("avx2"))) static void avxStore(const int *acc, const int *mask, int *w, int n) {
+	int i;
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m256i m = _mm256_loadu_si256((const __m256i *)(mask + i));
+		__m256i x = _mm256_loadu_si256((const __m256i *)(w + i));
+		__m256i a = _mm256_loadu_si256((const __m256i *)(acc + i));
+		_mm256_storeu_si256((__m256i *)(w + i), _mm256_blendv_epi8(x, AVX_ENC(a), m));
+	}
+	scalarStore(acc + i, mask + i, w + i, n - i);
+}
+
+__attribute__((target("avx2"))) static int avxBranch(int op, const int *acc, const int *mask, int *lpc, int target, int next, int n) {
+	__m256i t = _mm256_set1_epi32(target), f = _mm256_set1_epi32(next), z = _mm256_setzero_si256();
+	int i, r = 0;
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m256i m = _mm256_loadu_si256((const __m256i *)(mask + i));
+		__m256i a = _mm256_loadu_si256((const __m256i *)(acc + i));
+		__m256i p = _mm256_loadu_si256((const __m256i *)(lpc + i));
+		__m256i c = (op == 0x9) ? _mm256_cmpeq_epi32(a, z) : _mm256_cmpgt_epi32(z, a);
+		_mm256_storeu_si256((__m256i *)(lpc + i), _mm256_blendv_epi8(p, _mm256_blendv_epi8(f, t, c), m));
+		r |= (_mm256_movemask_epi8(_mm256_and_si256(c, m)) ? 1 : 0) |
+			(_mm256_movemask_epi8(_mm256_andnot_si256(c, m)) ? 2 : 0);
+	}
+	return r | scalarBranch(op, acc + i, mask + i, lpc + i, target, next, n - i);
+}
+
+__attribute__((target("avx2"))) static inline int avxMin(__m256i x) {
+	__m128i h = _mm_min_epi32(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1));
+	h = _mm_min_epi32(h, _mm_shuffle_epi32(h, 0x4E));
+	h = _mm_min_epi32(h, _mm_shuffle_epi32(h, 0xB1));
+	return _mm_cvtsi128_si32(h);
+}
+
+__attribute__((target("avx2"))) static int avxSelect(const int *lpc, int *mask, int n, int *wait) {
+	__m256i lo = _mm256_set1_epi32(SIMT_DONE), hi = lo, p, x, e;
+	int i, pc, w;
+	for (i = 0; i + 8 <= n; i += 8) lo = _mm256_min_epi32(lo, _mm256_loadu_si256((const __m256i *)(lpc + i)));
+	pc = avxMin(lo);
+	for (; i < n; i++) if (lpc[i] < pc) pc = lpc[i];
+	p = _mm256_set1_epi32(pc);
+	for (i = 0; i + 8 <= n; i += 8) {
+		x = _mm256_loadu_si256((const __m256i *)(lpc + i));
+		e = _mm256_cmpeq_epi32(x, p);
+		_mm256_storeu_si256((__m256i *)(mask + i), e);
+		hi = _mm256_min_epi32(hi, _mm256_blendv_epi8(x, _mm256_set1_epi32(SIMT_DONE), e));
+	}
+	w = avxMin(hi);
+	for (; i < n; i++) {
+		mask[i] = (lpc[i] == pc) ? -1 : 0;
+		if (lpc[i] > pc && lpc[i] < w) w = lpc[i];
+	}
+	*wait = w;
+	return pc;
+}
+
+static const SimtKernel simt_avx2 = {
+	"avx2", avxSupported, avxLoad, avxArith, avxIac, avxStore, avxBranch, avxSelect
+};
+#endif
+
+// Kernels by preference
+static const SimtKernel *const simt_kernels[] = {
+#if defined(__x86_64__) && defined(__GNUC__)
+	&simt_avx2, &simt_sse,
+#endif
+	&simt_scalar, NULL
+};
+
+const char *simt_isa = NULL;		// -simt-isa: kernel name, NULL: best the CPU runs
+
+// Kernel by name, or the best supported one
+const SimtKernel *simtKernel(const char *name) {
+	int i;
+
+	for (i = 0; simt_kernels[i] != NULL; i++) {
+		if (name != NULL && strcmp(name, simt_kernels[i]->name) != 0) continue;
+		if (simt_kernels[i]->supported()) return simt_kernels[i];
+	}
+	return NULL;
+}
+
+// DATA words of the lanes: data_bgn ~ below CODE section
+static int simtWords(AccComVM *vm) {
+	UINT end = vm->data_end;
+
+	if (vm->code_bgn >= vm->data_bgn && vm->code_bgn < end) end = vm->code_bgn;
+	return (end > vm->data_bgn) ? (int)(end - vm->data_bgn)/2 : 0;
+}
+
+// DATA word index of [addr, addr+1], -1: outside, -2: across a word boundary
+static inline int simtWord(AccComVM *vm, int nw, UINT addr) {
+	if (addr + 1 < vm->data_bgn || addr >= vm->data_bgn + 2*(UINT)nw) return -1;
+	if (addr < vm->data_bgn || (addr - vm->data_bgn)%2 != 0) return -2;
+	return (int)(addr - vm->data_bgn)/2;
+}
+
+static void simtPut(SweepJob *job, const char *data, size_t len) {
+	if (job->len + len > job->cap) {
+		job->cap = (job->len + len)*2 + 256;
+		job->buf = realloc(job->buf, job->cap);
+		if (job->buf == NULL) {
+			printf("Error: out of memory");
+			exit(-1);
+		}
+	}
+	memcpy(job->buf + job->len, data, len);
+	job->len += len;
+}
+
+static inline void simtPutc(SweepJob *job, int ch) {
+	char c = (char)ch;
+
+	if (job->len < job->cap) job->buf[job->len++] = c;
+	else simtPut(job, &c, 1);
+}
+
+// Byte at addr as lane i sees it
+static inline UCHAR simtByte(SimtGroup *g, AccComVM *code, int nw, int i, UINT addr) {
+	UINT off = addr - code->data_bgn;
+
+	if (addr < code->data_bgn || off >= 2*(UINT)nw) return code->mem[addr];
+	return (UCHAR)((off%2) ? g->word[(off/2)*SIMT_LANES + i] : g->word[(off/2)*SIMT_LANES + i] >> 8);
+}
+
+// Finish the masked lanes on a scalar machine from the group pc
+static void simtSpill(SimtGroup *g, AccComVM *code, int nw, AccComVM *vm) {
+	UINT start;
+	int i, k;
+
+	for (i = 0; i < g->n; i++) {
+		if (!g->mask[i]) continue;
+		vmReset(vm);
+		loadProgram(vm);
+		for (k = 0; k < nw; k++) writeWord(vm, code->data_bgn + 2*k, (UINT)g->word[k*SIMT_LANES + i]);
+		vm->acc = g->acc[i];
+		if (!g->first) updatePSW(vm);
+		start = (UINT)g->pc;
+		vm->out.mem_len = 0;
+		g->job[i]->exit_code = runProgram(vm, start);
+		simtPut(g->job[i], vm->out.mem, vm->out.mem_len);
+		g->lpc[i] = SIMT_DONE;
+		g->live--;
+	}
+}
+
+// Pack running lanes to the front of the vectors
+// - n stays a multiple of 8, ended lanes fill up the last vector
+static void simtRegroup(SimtGroup *g, int nw) {
+	int i, j, k;
+
+	for (i = j = 0; i < g->n; i++) {
+		if (g->lpc[i] == SIMT_DONE) continue;
+		if (i != j) {
+			g->acc[j] = g->acc[i];
+			g->lpc[j] = g->lpc[i];
+			g->job[j] = g->job[i];
+			for (k = 0; k < nw; k++) g->word[k*SIMT_LANES + j] = g->word[k*SIMT_LANES + i];
+		}
+		j++;
+	}
+	for (g->n = (j + 7) & ~7; j < g->n; j++) g->lpc[j] = SIMT_DONE;
+}
+
+// Lanes at the lowest pc run next, the group stops at the pc of the others
+static void simtSelect(const SimtKernel *kern, SimtGroup *g, int nw) {
+	if (g->live <= g->n/2) simtRegroup(g, nw);
+	g->pc = kern->select(g->lpc, g->mask, g->n, &g->wait);
+}
+
+// Run jobs job[0] ~ job[n - 1] (n <= SIMT_LANES) in lockstep
+// - code: the program loaded once, only read; vm: scalar machine for spills
+static void simtRun(const SimtKernel *kern, SimtGroup *g, AccComVM *code, UINT entry, UINT height,
+	SweepJob *job, int n, AccComVM *vm) {
+	int nw = simtWords(code), hk = simtWord(code, nw, height);
+	int i, k, w, x, op;
+	DecodedInst d;
+	UINT a;
+	UCHAR ch;
+	char str[16];
+
+	g->live = n;
+	g->n = (n + 7) & ~7;
+	g->first = 1;
+	for (i = 0; i < g->n; i++) {
+		g->job[i] = &job[i];
+		g->acc[i] = 0;
+		g->lpc[i] = (i < n) ? (int)entry : SIMT_DONE;
+		for (k = 0; k < nw; k++) g->word[k*SIMT_LANES + i] = (int)readWord(code, code->data_bgn + 2*k);
+		g->word[hk*SIMT_LANES + i] = (int)cint2accnum((i < n) ? job[i].height : 0);
+	}
+	simtSelect(kern, g, nw);
+
+	while (g->live > 0) {
+		if (g->pc == g->wait) {				// other lanes wait here: run on together
+			for (i = 0; i < g->n; i++) if (g->mask[i]) g->lpc[i] = g->pc;
+			simtSelect(kern, g, nw);
+		}
+		if (g->pc == (int)code->code_end) {			// ran off the end
+			for (i = 0; i < g->n; i++) if (g->mask[i]) { g->lpc[i] = SIMT_DONE; g->live--; }
+			goto reselect;
+		}
+		if (!codeAt(code, (UINT)g->pc)) {
+			simtSpill(g, code, nw, vm);
+			goto reselect;
+		}
+		d = code->decoded[g->pc];
+		op = d.op;
+		w = (op == 0x1 || op == 0x2 || op == 0x3 || op == 0x4 || op == 0x7 || op == 0xB) ?
+			simtWord(code, nw, d.operand) : 0;
+#ifdef MEM_CHECK
+		if (w == -1) w = -2;		// out-of-range words trap on the scalar machine
+#endif
+		if (w == -2 || (w == -1 && op == 0x2) || op == 0x6 ||
+			(op == 0x8 && (d.operand == 0x001 || d.operand == 0x003 || d.operand == 0x004)) ||
+			((op == 0x5 || op == 0x9 || op == 0xA) && !codeAt(code, d.operand) && d.operand != code->code_end)) {
+			simtSpill(g, code, nw, vm);
+			goto reselect;
+		}
+		if (w == -1) {			// outside DATA: the same word in every lane
+			x = (int)readWord(code, d.operand);
+			for (i = 0; i < g->n; i++) g->bcast[i] = x;
+		}
+		switch (op) {
+		case 0x1: kern->load(g->acc, g->mask, (w >= 0) ? g->word + w*SIMT_LANES : g->bcast, g->n); break;
+		case 0x2: kern->store(g->acc, g->mask, g->word + w*SIMT_LANES, g->n); break;
+		case 0x3: case 0x4: case 0x7:
+			kern->arith(op, g->acc, g->mask, (w >= 0) ? g->word + w*SIMT_LANES : g->bcast, g->n);
+			break;
+		case 0x5: case 0x9: case 0xA:
+			// x: where all masked lanes go, -1: they split
+			if (op == 0x5) x = (int)d.operand;
+			else if (g->first) x = g->pc + 2;		// PSW 0, 0: not taken
+			else {
+				k = kern->branch(op, g->acc, g->mask, g->lpc, (int)d.operand, g->pc + 2, g->n);
+				x = (k == 1) ? (int)d.operand : (k == 2) ? g->pc + 2 : -1;
+			}
+			g->first = 0;
+			if (x >= 0 && x < g->wait) {		// still the lowest pc, same lanes
+				g->pc = x;
+				continue;
+			}
+			if (x >= 0) for (i = 0; i < g->n; i++) if (g->mask[i]) g->lpc[i] = x;
+			goto reselect;
+		case 0xB:
+			for (i = 0; i < g->n; i++) {
+				if (!g->mask[i]) continue;
+				x = (w >= 0) ? g->word[w*SIMT_LANES + i] : g->bcast[i];
+				simtPut(g->job[i], str, snprintf(str, sizeof(str), "%d", simtDec(x)));
+			}
+			break;
+		case 0xC:
+			for (i = 0; i < g->n; i++) if (g->mask[i]) simtPutc(g->job[i], (int)d.operand);
+			break;
+		case 0xD:
+			for (i = 0; i < g->n; i++) {
+				if (!g->mask[i]) continue;
+				for (a = d.operand; a < MEM_ALLOC && (ch = simtByte(g, code, nw, i, a)) != 0; a++)
+					simtPutc(g->job[i], ch);
+			}
+			break;
+		case 0x8:
+			if (d.operand == 0x002) { kern->iac(g->acc, g->mask, g->n); break; }
+			if (d.operand == 0x000) {		// HLT
+				for (i = 0; i < g->n; i++) if (g->mask[i]) { g->lpc[i] = SIMT_DONE; g->live--; }
+				goto reselect;
+			}
+			// fall through
+		default:
+			for (i = 0; i < g->n; i++) {
+				if (!g->mask[i]) continue;
+				simtPut(g->job[i], "else raised\n", 12);
+				g->lpc[i] = SIMT_DONE;
+				g->live--;
+			}
+			goto reselect;
+		}
+		g->first = 0;
+		g->pc += 2;
+		continue;
+
+	reselect:
+		if (g->live > 0) simtSelect(kern, g, nw);
+	}
+}
+
+void *simtWorker(void *arg) {
+	SweepPool *pool = arg;
+	const SimtKernel *kern = simtKernel(pool->simt);
+	AccComVM *code = vmCreate();		// the program, shared by the lanes
+	AccComVM *vm = vmCreate();			// scalar machine for spilled lanes
+	SimtGroup *g = calloc(1, sizeof(SimtGroup));
+	UINT entry;
+	int i, n;
+
+	entry = loadProgram(code);
+	if (g == NULL || (g->word = malloc((size_t)simtWords(code)*SIMT_LANES*sizeof(int) + 1)) == NULL) {
+		printf("Error: out of memory");
+		exit(-1);
+	}
+	sinkMemory(&vm->out);
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		i = pool->next;
+		n = (pool->count - i < SIMT_LANES) ? pool->count - i : SIMT_LANES;
+		pool->next += n;
+		pthread_mutex_unlock(&pool->lock);
+		if (n <= 0) break;
+		simtRun(kern, g, code, entry, pool->height, pool->job + i, n, vm);
+	}
+	free(g->word);
+	free(g);
+	vmDestroy(code);
+	vmDestroy(vm);
+	return NULL;
+}
+
+// Can the loaded program run as SIMT lanes: Height is a DATA word
+int simtUsable(void) {
+	AccComVM *vm = vmCreate();
+	int height, ok;
+
+	loadProgram(vm);
+	height = inputAddr(vm, "Height");
+	ok = height >= 0 && simtWord(vm, simtWords(vm), (UINT)height) >= 0;
+	vmDestroy(vm);
+	return ok;
+}
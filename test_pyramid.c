@@ -1,27 +1,59 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-int main()
+// Pyramid of '#' with n rows: row b is (n - b) spaces, (2b - 1) '#'
+//
+//   test_pyramid [height]		height from argv, else stdin, else 5
+//
+// - every row is a slice of one line of (n - 1) spaces and (2n - 1)
+//   '#': row b starts at offset b - 1 and is n + b - 1 bytes long
+// - rows are copied into a large buffer and written in big chunks
+
+#define OUT_SIZE	(1 << 20)	// output buffer
+
+static char out[OUT_SIZE];
+static size_t out_len;
+
+static void put(const char *data, size_t len)
 {
-	int a= 5;
-	int n = a;
-	int b = 1;
-	int cnt;
-	while(b <= n)
-	{
-		cnt = 1;
-		int c = b+1;
-		while(c <= n){
-			printf(" ");
-			c++;
+	if (out_len + len > OUT_SIZE) {
+		fwrite(out, 1, out_len, stdout);
+		out_len = 0;
+		if (len > OUT_SIZE) {		// longer than the buffer: write through
+			fwrite(data, 1, len, stdout);
+			return;
 		}
-		while(cnt <= 2*b-1)
-		{
-			printf("#");
-			cnt++;
-		}
-		printf("\n");
-		b++;
 	}
+	memcpy(out + out_len, data, len);
+	out_len += len;
+}
+
+int main(int argc, char *argv[])
+{
+	int a= 5;
+	int n;
+	int b;
+	char *line;
+
+	if (argc > 1) a = atoi(argv[1]);
+	else if (scanf("%d", &n) == 1) a = n;
+	n = a;
+	if (n <= 0) return 0;
+
+	line = malloc(3*(size_t)n - 2);
+	if (line == NULL) {
+		printf("Error: out of memory");
+		return 1;
+	}
+	memset(line, ' ', n - 1);
+	memset(line + n - 1, '#', 2*(size_t)n - 1);
+
+	for (b = 1; b <= n; b++) {
+		put(line + b - 1, (size_t)n + b - 1);
+		put("\n", 1);
+	}
+	fwrite(out, 1, out_len, stdout);
+	free(line);
 	return 0;
 }